@@ -0,0 +1,233 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2025 Stanford University and the Authors.           *
+ * Authors: Peter Eastman                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+
+
+/**
+ * This program checks how well energy is conserved when simulating with OnnxForce at different precisions.
+ * Cheaper settings, such as reduced TensorRT precision or a platform's single precision mode, make each step
+ * faster, but the forces may no longer be accurate enough.  The most sensitive test of that is whether energy
+ * is conserved in a constant energy simulation.
+ *
+ * For each combination of execution provider and precision, it runs a simulation with a VerletIntegrator and
+ * records the total energy at regular intervals.  It fits a straight line to the energy as a function of time,
+ * and reports the slope (the drift, in kJ/mol/ns per degree of freedom), the RMS deviation from the line (the
+ * fluctuation, in kJ/mol), and the average time per step.  A drift that is much larger than for "fp32" or
+ * "double" indicates the cheaper setting is not safe.
+ *
+ * Create the model by running createBenchmarks.py.  Options are given as --name=value:
+ *
+ *   --model               the model to simulate (default pairwise.onnx)
+ *   --particles           the number of particles (default 1000)
+ *   --providers           a comma separated list of execution providers (default CPU,CUDA,TensorRT,ROCm)
+ *   --tensorRTPrecisions  a comma separated list of values for TensorRTPrecision (default fp32,fp16)
+ *   --platform            the OpenMM platform to use (default Reference)
+ *   --platformPrecisions  a comma separated list of values for the platform's Precision property.  By default
+ *                         it is not set.
+ *   --steps               the number of time steps to simulate (default 10000)
+ *   --stepSize            the step size in ps (default 0.0005)
+ *   --interval            the number of steps between energy evaluations (default 10)
+ *   --temperature         the temperature in K used to set the initial velocities (default 300)
+ */
+
+#include "OnnxForce.h"
+#include "openmm/Context.h"
+#include "openmm/OpenMMException.h"
+#include "openmm/Platform.h"
+#include "openmm/System.h"
+#include "openmm/VerletIntegrator.h"
+#include "sfmt/SFMT.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace OnnxPlugin;
+using namespace OpenMM;
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+struct Result {
+    double drift, fluctuation, stepTime;
+};
+
+static vector<string> split(const string& list) {
+    vector<string> values;
+    stringstream stream(list);
+    string value;
+    while (getline(stream, value, ','))
+        values.push_back(value);
+    return values;
+}
+
+static OnnxForce::ExecutionProvider getProvider(const string& name) {
+    if (name == "CPU")
+        return OnnxForce::CPU;
+    if (name == "CUDA")
+        return OnnxForce::CUDA;
+    if (name == "TensorRT")
+        return OnnxForce::TensorRT;
+    if (name == "ROCm")
+        return OnnxForce::ROCm;
+    throw OpenMMException("Unknown execution provider: "+name);
+}
+
+Result runSimulation(const map<string, string>& options, Platform& platform, OnnxForce::ExecutionProvider provider,
+                     const string& tensorRTPrecision, const string& platformPrecision) {
+    // Create a random cloud of particles at roughly the density of water.
+
+    int numParticles = atoi(options.at("particles").c_str());
+    int numSteps = atoi(options.at("steps").c_str());
+    int interval = atoi(options.at("interval").c_str());
+    double stepSize = atof(options.at("stepSize").c_str());
+    double boxSize = pow(numParticles/100.0, 1.0/3.0);
+    System system;
+    vector<Vec3> positions(numParticles);
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    for (int i = 0; i < numParticles; i++) {
+        system.addParticle(12.0);
+        positions[i] = Vec3(genrand_real2(sfmt), genrand_real2(sfmt), genrand_real2(sfmt))*boxSize;
+    }
+    OnnxForce* force = new OnnxForce(options.at("model"));
+    force->setExecutionProvider(provider);
+    force->setProperty("TensorRTPrecision", tensorRTPrecision);
+    system.addForce(force);
+    map<string, string> platformProperties;
+    if (platformPrecision.size() > 0)
+        platformProperties["Precision"] = platformPrecision;
+    VerletIntegrator integrator(stepSize);
+    Context context(system, integrator, platform, platformProperties);
+    context.setPositions(positions);
+    context.setVelocitiesToTemperature(atof(options.at("temperature").c_str()));
+
+    // Simulate, recording the total energy at regular intervals.
+
+    vector<double> times, energies;
+    Clock::time_point start = Clock::now();
+    for (int step = 0; step <= numSteps; step += interval) {
+        if (step > 0)
+            integrator.step(interval);
+        State state = context.getState(State::Energy);
+        times.push_back(step*stepSize);
+        energies.push_back(state.getPotentialEnergy()+state.getKineticEnergy());
+    }
+    double elapsed = chrono::duration<double, milli>(Clock::now()-start).count();
+
+    // Fit a line to the energy and compute the deviations from it.
+
+    int numPoints = times.size();
+    double meanTime = 0, meanEnergy = 0;
+    for (int i = 0; i < numPoints; i++) {
+        meanTime += times[i]/numPoints;
+        meanEnergy += energies[i]/numPoints;
+    }
+    double covariance = 0, variance = 0;
+    for (int i = 0; i < numPoints; i++) {
+        covariance += (times[i]-meanTime)*(energies[i]-meanEnergy);
+        variance += (times[i]-meanTime)*(times[i]-meanTime);
+    }
+    double slope = (variance > 0 ? covariance/variance : 0);
+    double sumSquares = 0;
+    for (int i = 0; i < numPoints; i++) {
+        double deviation = energies[i]-(meanEnergy+slope*(times[i]-meanTime));
+        sumSquares += deviation*deviation;
+    }
+    Result result;
+    result.drift = 1000*slope/(3*numParticles);
+    result.fluctuation = sqrt(sumSquares/numPoints);
+    result.stepTime = elapsed/max(numSteps, 1);
+    return result;
+}
+
+int main(int argc, char* argv[]) {
+    map<string, string> options = {{"model", "pairwise.onnx"}, {"particles", "1000"}, {"providers", "CPU,CUDA,TensorRT,ROCm"},
+            {"tensorRTPrecisions", "fp32,fp16"}, {"platform", "Reference"}, {"platformPrecisions", ""}, {"steps", "10000"},
+            {"stepSize", "0.0005"}, {"interval", "10"}, {"temperature", "300"}};
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        size_t separator = arg.find('=');
+        if (arg.substr(0, 2) != "--" || separator == string::npos || options.find(arg.substr(2, separator-2)) == options.end()) {
+            cout << "Unknown option: " << arg << endl;
+            return 1;
+        }
+        options[arg.substr(2, separator-2)] = arg.substr(separator+1);
+    }
+    for (string option : {"particles", "steps", "interval"})
+        if (atoi(options[option].c_str()) < 1) {
+            cout << "Illegal value for " << option << ": " << options[option] << endl;
+            return 1;
+        }
+    try {
+        Platform::loadPluginsFromDirectory(Platform::getDefaultPluginsDirectory());
+        Platform& platform = Platform::getPlatformByName(options["platform"]);
+        vector<string> platformPrecisions = split(options["platformPrecisions"]);
+        if (platformPrecisions.size() == 0)
+            platformPrecisions.push_back("");
+        printf("%-10s %-8s %-8s %16s %16s %13s\n", "Provider", "TensorRT", "Platform", "Drift(/ns/dof)", "Fluctuation", "Step(ms)");
+        for (const string& providerName : split(options["providers"])) {
+            OnnxForce::ExecutionProvider provider = getProvider(providerName);
+
+            // TensorRTPrecision only affects the TensorRT provider.
+
+            vector<string> tensorRTPrecisions = {"fp32"};
+            if (provider == OnnxForce::TensorRT)
+                tensorRTPrecisions = split(options["tensorRTPrecisions"]);
+            for (const string& tensorRTPrecision : tensorRTPrecisions)
+                for (const string& platformPrecision : platformPrecisions) {
+                    printf("%-10s %-8s %-8s ", providerName.c_str(), (provider == OnnxForce::TensorRT ? tensorRTPrecision.c_str() : "-"),
+                            (platformPrecision.size() > 0 ? platformPrecision.c_str() : "-"));
+                    fflush(stdout);
+                    try {
+                        Result result = runSimulation(options, platform, provider, tensorRTPrecision, platformPrecision);
+                        printf("%16.4g %16.4g %13.3f\n", result.drift, result.fluctuation, result.stepTime);
+                    }
+                    catch (const OpenMMException& e) {
+                        // The provider is not available, or the model could not be evaluated with these settings.
+
+                        printf("failed: %s\n", e.what());
+                    }
+                }
+        }
+    }
+    catch (const exception& e) {
+        cout << "exception: " << e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,208 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2025 Stanford University and the Authors.           *
+ * Authors: Peter Eastman                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+
+/**
+ * This program measures the performance of OnnxForce.  For each combination of execution provider, particle
+ * count, and graph setting, it reports the time to create a Context (which includes creating the session),
+ * the latency of the first evaluation (which includes building TensorRT engines and recording graphs), and
+ * percentiles of the latency of later evaluations.
+ *
+ * It also evaluates a model that does almost no computation.  Its latency is dominated by copying data to and
+ * from the device and other fixed costs, so its ratio to the latency of the real model estimates the share of
+ * each step that goes to overhead rather than computation.
+ *
+ * Create the models by running createBenchmarks.py.  Options are given as --name=value:
+ *
+ *   --model           the model to benchmark (default pairwise.onnx)
+ *   --overheadModel   the model used to measure overhead (default overhead.onnx)
+ *   --particles       a comma separated list of particle counts (default 100,1000,4000)
+ *   --providers       a comma separated list of execution providers (default CPU,CUDA,TensorRT,ROCm)
+ *   --graphs          a comma separated list of values for UseGraphs (default false,true)
+ *   --steps           the number of evaluations to time for each combination (default 100)
+ *   --platform        the OpenMM platform to use (default Reference)
+ */
+
+#include "OnnxForce.h"
+#include "openmm/Context.h"
+#include "openmm/OpenMMException.h"
+#include "openmm/Platform.h"
+#include "openmm/System.h"
+#include "openmm/VerletIntegrator.h"
+#include "sfmt/SFMT.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace OnnxPlugin;
+using namespace OpenMM;
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+struct Result {
+    double createTime, firstTime, p50, p90, p99;
+};
+
+static double elapsedMilliseconds(Clock::time_point start) {
+    return chrono::duration<double, milli>(Clock::now()-start).count();
+}
+
+static vector<string> split(const string& list) {
+    vector<string> values;
+    stringstream stream(list);
+    string value;
+    while (getline(stream, value, ','))
+        values.push_back(value);
+    return values;
+}
+
+static OnnxForce::ExecutionProvider getProvider(const string& name) {
+    if (name == "CPU")
+        return OnnxForce::CPU;
+    if (name == "CUDA")
+        return OnnxForce::CUDA;
+    if (name == "TensorRT")
+        return OnnxForce::TensorRT;
+    if (name == "ROCm")
+        return OnnxForce::ROCm;
+    throw OpenMMException("Unknown execution provider: "+name);
+}
+
+Result runBenchmark(const string& model, Platform& platform, OnnxForce::ExecutionProvider provider, const string& useGraphs,
+                    int numParticles, int numSteps) {
+    // Create a random cloud of particles at roughly the density of water.
+
+    double boxSize = pow(numParticles/100.0, 1.0/3.0);
+    System system;
+    vector<Vec3> positions(numParticles);
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    for (int i = 0; i < numParticles; i++) {
+        system.addParticle(1.0);
+        positions[i] = Vec3(genrand_real2(sfmt), genrand_real2(sfmt), genrand_real2(sfmt))*boxSize;
+    }
+    OnnxForce* force = new OnnxForce(model);
+    force->setExecutionProvider(provider);
+    force->setProperty("UseGraphs", useGraphs);
+    system.addForce(force);
+
+    // Time creating the Context and the first evaluation.
+
+    Result result;
+    VerletIntegrator integrator(0.001);
+    Clock::time_point start = Clock::now();
+    Context context(system, integrator, platform);
+    result.createTime = elapsedMilliseconds(start);
+    context.setPositions(positions);
+    start = Clock::now();
+    context.getState(State::Forces);
+    result.firstTime = elapsedMilliseconds(start);
+
+    // Time later evaluations.  The positions are changed before each one, since otherwise the previous result
+    // would be reused.
+
+    vector<double> times(numSteps);
+    for (int step = 0; step < numSteps; step++) {
+        positions[step%numParticles][0] += 1e-4;
+        context.setPositions(positions);
+        start = Clock::now();
+        context.getState(State::Forces);
+        times[step] = elapsedMilliseconds(start);
+    }
+    sort(times.begin(), times.end());
+    result.p50 = times[(numSteps-1)/2];
+    result.p90 = times[(9*(numSteps-1))/10];
+    result.p99 = times[(99*(numSteps-1))/100];
+    return result;
+}
+
+int main(int argc, char* argv[]) {
+    map<string, string> options = {{"model", "pairwise.onnx"}, {"overheadModel", "overhead.onnx"}, {"particles", "100,1000,4000"},
+            {"providers", "CPU,CUDA,TensorRT,ROCm"}, {"graphs", "false,true"}, {"steps", "100"}, {"platform", "Reference"}};
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        size_t separator = arg.find('=');
+        if (arg.substr(0, 2) != "--" || separator == string::npos || options.find(arg.substr(2, separator-2)) == options.end()) {
+            cout << "Unknown option: " << arg << endl;
+            return 1;
+        }
+        options[arg.substr(2, separator-2)] = arg.substr(separator+1);
+    }
+    int numSteps = atoi(options["steps"].c_str());
+    if (numSteps < 1) {
+        cout << "Illegal value for steps: " << options["steps"] << endl;
+        return 1;
+    }
+    try {
+        Platform::loadPluginsFromDirectory(Platform::getDefaultPluginsDirectory());
+        Platform& platform = Platform::getPlatformByName(options["platform"]);
+        printf("%-10s %-6s %9s %11s %11s %9s %9s %9s %9s\n", "Provider", "Graphs", "Particles", "Create(ms)", "First(ms)",
+                "p50(ms)", "p90(ms)", "p99(ms)", "Overhead");
+        for (const string& providerName : split(options["providers"])) {
+            OnnxForce::ExecutionProvider provider = getProvider(providerName);
+            for (const string& useGraphs : split(options["graphs"])) {
+                // Graphs only exist on GPUs.
+
+                if (provider == OnnxForce::CPU && useGraphs == "true")
+                    continue;
+                for (const string& particles : split(options["particles"])) {
+                    int numParticles = atoi(particles.c_str());
+                    printf("%-10s %-6s %9d ", providerName.c_str(), useGraphs.c_str(), numParticles);
+                    fflush(stdout);
+                    try {
+                        Result result = runBenchmark(options["model"], platform, provider, useGraphs, numParticles, numSteps);
+                        Result overhead = runBenchmark(options["overheadModel"], platform, provider, useGraphs, numParticles, numSteps);
+                        printf("%11.2f %11.2f %9.3f %9.3f %9.3f %8.1f%%\n", result.createTime, result.firstTime, result.p50,
+                                result.p90, result.p99, 100*min(1.0, overhead.p50/result.p50));
+                    }
+                    catch (const OpenMMException& e) {
+                        // The provider is not available, or the model could not be evaluated with these settings.
+
+                        printf("failed: %s\n", e.what());
+                    }
+                }
+            }
+        }
+    }
+    catch (const exception& e) {
+        cout << "exception: " << e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
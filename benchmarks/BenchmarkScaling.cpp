@@ -0,0 +1,256 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2025 Stanford University and the Authors.           *
+ * Authors: Peter Eastman                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+
+
+/**
+ * This program measures how the cost of OnnxForce scales with the size of the System and with the fraction of
+ * particles the model is applied to.  For each combination of execution provider, particle count, and subset
+ * fraction, it selects particles evenly spread through the System with setParticleIndices(), simulates a few
+ * steps, and reports the time to create the Context, percentiles of the time per step, the median time per
+ * particle in the subset, and the peak memory used by the process.
+ *
+ * If the cost only depended on the size of the subset, the time per subset particle would be independent of both
+ * the System size and the fraction.  When it grows as the fraction shrinks, some part of each step scales with
+ * the whole System rather than the subset.  Large differences between the median and the 99th percentile usually
+ * indicate work that is only done on some steps, such as reallocating buffers.
+ *
+ * Peak memory is the high-water mark of the resident set size.  On Linux it is reset before each combination, so
+ * it reflects only that combination.  On other systems it is the peak for the whole run so far.  Memory allocated
+ * on GPUs is not included.
+ *
+ * Create the model by running createBenchmarks.py.  Options are given as --name=value:
+ *
+ *   --model       the model to benchmark (default local.onnx)
+ *   --particles   a comma separated list of particle counts (default 1000,10000,100000,1000000)
+ *   --fractions   a comma separated list of the fractions of particles to apply the model to
+ *                 (default 0.01,0.1,0.5,1)
+ *   --providers   a comma separated list of execution providers (default CPU,CUDA,TensorRT,ROCm)
+ *   --steps       the number of time steps to time for each combination (default 20)
+ *   --platform    the OpenMM platform to use (default Reference)
+ */
+
+#include "OnnxForce.h"
+#include "openmm/Context.h"
+#include "openmm/OpenMMException.h"
+#include "openmm/Platform.h"
+#include "openmm/System.h"
+#include "openmm/VerletIntegrator.h"
+#include "sfmt/SFMT.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+using namespace OnnxPlugin;
+using namespace OpenMM;
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+struct Result {
+    double createTime, p50, p99, peakMemory;
+};
+
+static double elapsedMilliseconds(Clock::time_point start) {
+    return chrono::duration<double, milli>(Clock::now()-start).count();
+}
+
+static vector<string> split(const string& list) {
+    vector<string> values;
+    stringstream stream(list);
+    string value;
+    while (getline(stream, value, ','))
+        values.push_back(value);
+    return values;
+}
+
+static OnnxForce::ExecutionProvider getProvider(const string& name) {
+    if (name == "CPU")
+        return OnnxForce::CPU;
+    if (name == "CUDA")
+        return OnnxForce::CUDA;
+    if (name == "TensorRT")
+        return OnnxForce::TensorRT;
+    if (name == "ROCm")
+        return OnnxForce::ROCm;
+    throw OpenMMException("Unknown execution provider: "+name);
+}
+
+/**
+ * Reset the high-water mark of the resident set size to the current value.  This is only possible on Linux.
+ */
+static void resetPeakMemory() {
+#ifdef __linux__
+    ofstream clearRefs("/proc/self/clear_refs");
+    clearRefs << "5";
+#endif
+}
+
+/**
+ * Get the high-water mark of the resident set size in MB, or -1 if it is not available.
+ */
+static double getPeakMemory() {
+#ifdef __linux__
+    ifstream status("/proc/self/status");
+    string line;
+    while (getline(status, line))
+        if (line.compare(0, 6, "VmHWM:") == 0)
+            return atof(line.substr(6).c_str())/1024;
+#endif
+#ifndef _WIN32
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#ifdef __APPLE__
+        return usage.ru_maxrss/(1024.0*1024.0);
+#else
+        return usage.ru_maxrss/1024.0;
+#endif
+    }
+#endif
+    return -1;
+}
+
+Result runBenchmark(const string& model, Platform& platform, OnnxForce::ExecutionProvider provider, int numParticles,
+                    int subsetSize, int numSteps) {
+    // Create a random cloud of particles at roughly the density of water, and apply the model to a subset spread
+    // evenly through it.
+
+    double boxSize = pow(numParticles/100.0, 1.0/3.0);
+    System system;
+    vector<Vec3> positions(numParticles);
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    for (int i = 0; i < numParticles; i++) {
+        system.addParticle(1.0);
+        positions[i] = Vec3(genrand_real2(sfmt), genrand_real2(sfmt), genrand_real2(sfmt))*boxSize;
+    }
+    OnnxForce* force = new OnnxForce(model);
+    force->setExecutionProvider(provider);
+    if (subsetSize < numParticles) {
+        vector<int> indices(subsetSize);
+        for (int i = 0; i < subsetSize; i++)
+            indices[i] = (int) ((long long) i*numParticles/subsetSize);
+        force->setParticleIndices(indices);
+    }
+    system.addForce(force);
+
+    // Time creating the Context, then take one step so the first evaluation (which includes building TensorRT
+    // engines) is not included in the timings.
+
+    Result result;
+    resetPeakMemory();
+    VerletIntegrator integrator(0.0001);
+    Clock::time_point start = Clock::now();
+    Context context(system, integrator, platform);
+    result.createTime = elapsedMilliseconds(start);
+    context.setPositions(positions);
+    integrator.step(1);
+    vector<double> times(numSteps);
+    for (int step = 0; step < numSteps; step++) {
+        start = Clock::now();
+        integrator.step(1);
+        times[step] = elapsedMilliseconds(start);
+    }
+    result.peakMemory = getPeakMemory();
+    sort(times.begin(), times.end());
+    result.p50 = times[(numSteps-1)/2];
+    result.p99 = times[(99*(numSteps-1))/100];
+    return result;
+}
+
+int main(int argc, char* argv[]) {
+    map<string, string> options = {{"model", "local.onnx"}, {"particles", "1000,10000,100000,1000000"}, {"fractions", "0.01,0.1,0.5,1"},
+            {"providers", "CPU,CUDA,TensorRT,ROCm"}, {"steps", "20"}, {"platform", "Reference"}};
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        size_t separator = arg.find('=');
+        if (arg.substr(0, 2) != "--" || separator == string::npos || options.find(arg.substr(2, separator-2)) == options.end()) {
+            cout << "Unknown option: " << arg << endl;
+            return 1;
+        }
+        options[arg.substr(2, separator-2)] = arg.substr(separator+1);
+    }
+    int numSteps = atoi(options["steps"].c_str());
+    if (numSteps < 1) {
+        cout << "Illegal value for steps: " << options["steps"] << endl;
+        return 1;
+    }
+    for (const string& fraction : split(options["fractions"])) {
+        double value = atof(fraction.c_str());
+        if (!(value > 0 && value <= 1)) {
+            cout << "Illegal value for fractions: " << fraction << endl;
+            return 1;
+        }
+    }
+    try {
+        Platform::loadPluginsFromDirectory(Platform::getDefaultPluginsDirectory());
+        Platform& platform = Platform::getPlatformByName(options["platform"]);
+        printf("%-10s %9s %9s %11s %9s %9s %11s %12s\n", "Provider", "Particles", "Subset", "Create(ms)", "p50(ms)", "p99(ms)",
+                "ns/particle", "PeakMem(MB)");
+        for (const string& providerName : split(options["providers"])) {
+            OnnxForce::ExecutionProvider provider = getProvider(providerName);
+            for (const string& particles : split(options["particles"])) {
+                int numParticles = atoi(particles.c_str());
+                for (const string& fraction : split(options["fractions"])) {
+                    int subsetSize = max(1, min(numParticles, (int) round(numParticles*atof(fraction.c_str()))));
+                    printf("%-10s %9d %9d ", providerName.c_str(), numParticles, subsetSize);
+                    fflush(stdout);
+                    try {
+                        Result result = runBenchmark(options["model"], platform, provider, numParticles, subsetSize, numSteps);
+                        printf("%11.2f %9.3f %9.3f %11.1f %12.1f\n", result.createTime, result.p50, result.p99,
+                                1e6*result.p50/subsetSize, result.peakMemory);
+                    }
+                    catch (const OpenMMException& e) {
+                        // The provider is not available, or the model could not be evaluated with these settings.
+
+                        printf("failed: %s\n", e.what());
+                    }
+                }
+            }
+        }
+    }
+    catch (const exception& e) {
+        cout << "exception: " << e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,67 @@
+import torch
+
+# A model with a realistic amount of computation: a soft repulsion between all pairs of particles,
+# followed by a small per-particle network.
+
+class Pairwise(torch.nn.Module):
+    def __init__(self):
+        super().__init__()
+        self.network = torch.nn.Sequential(torch.nn.Linear(1, 64), torch.nn.SiLU(), torch.nn.Linear(64, 1))
+
+    def forward(self, positions):
+        positions.grad = None
+        delta = positions.unsqueeze(1) - positions.unsqueeze(0)
+        r2 = torch.sum(delta*delta, dim=2)
+        density = torch.sum(torch.exp(-r2/0.1), dim=1, keepdim=True)
+        energy = torch.sum(self.network(density))
+        energy.backward()
+        forces = -positions.grad
+        return energy, forces
+
+torch.onnx.export(model=Pairwise(),
+                  args=(torch.rand(10, 3, requires_grad=True),),
+                  f="pairwise.onnx",
+                  input_names=["positions"],
+                  output_names=["energy", "forces"],
+                  dynamic_axes={"positions":[0], "forces":[0]})
+
+
+# A model that does almost no computation.  Its cost is dominated by copying the inputs and outputs
+# and other fixed overhead.
+
+class Overhead(torch.nn.Module):
+    def forward(self, positions):
+        energy = torch.sum(positions)*0
+        forces = positions*0
+        return energy, forces
+
+torch.onnx.export(model=Overhead(),
+                  args=(torch.rand(10, 3),),
+                  f="overhead.onnx",
+                  input_names=["positions"],
+                  output_names=["energy", "forces"],
+                  dynamic_axes={"positions":[0], "forces":[0]})
+
+
+# A model whose cost is proportional to the number of particles: a small network applied to each particle
+# independently.  It is used to measure how performance scales to very large systems, where a model that
+# considers all pairs would be too expensive.
+
+class Local(torch.nn.Module):
+    def __init__(self):
+        super().__init__()
+        self.network = torch.nn.Sequential(torch.nn.Linear(3, 32), torch.nn.SiLU(), torch.nn.Linear(32, 1))
+
+    def forward(self, positions):
+        positions.grad = None
+        energy = torch.sum(self.network(torch.sin(positions)))
+        energy.backward()
+        forces = -positions.grad
+        return energy, forces
+
+torch.onnx.export(model=Local(),
+                  args=(torch.rand(10, 3, requires_grad=True),),
+                  f="local.onnx",
+                  input_names=["positions"],
+                  output_names=["energy", "forces"],
+                  dynamic_axes={"positions":[0], "forces":[0]})
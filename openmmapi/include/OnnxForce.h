@@ -36,6 +36,8 @@
 #include "openmm/Force.h"
 #include "internal/windowsExportOnnx.h"
 #include <map>
+#include <memory>
+#include <string>
 #include <vector>
 
 namespace OnnxPlugin {
@@ -79,7 +81,8 @@ public:
         ROCm = 4,
     };
     /**
-     * Create an OnnxForce by loading the ONNX model from a file.
+     * Create an OnnxForce by loading the ONNX model from a file.  All OnnxForces that load
+     * the same unmodified file share a single copy of the model in memory.
      *
      * @param file       the path to the file containing the model
      * @param properties optional map of properties
@@ -97,6 +100,80 @@ public:
      * Get the binary representation of the model in ONNX format.
      */
     const std::vector<uint8_t>& getModel() const;
+    /**
+     * Get the path to the file the model was loaded from.  If the force was created from a vector,
+     * this is an empty string.
+     */
+    const std::string& getModelFile() const;
+    /**
+     * Get whether serializing this force stores a reference to the model file instead of the model
+     * itself.
+     */
+    bool getSerializeModelAsReference() const;
+    /**
+     * Set whether serializing this force stores a reference to the model file instead of the model
+     * itself.  This makes serialized Systems much smaller when the model is large, but the file must
+     * still exist at the same path, with the same contents, when the force is deserialized.  A hash of
+     * the model is stored to detect changes to the file.  This can only be used if the force was created
+     * from a file.
+     */
+    void setSerializeModelAsReference(bool reference);
+    /**
+     * Get the optional model that computes only the energy.  If no energy-only model has been set,
+     * this is empty.
+     */
+    const std::vector<uint8_t>& getEnergyOnlyModel() const;
+    /**
+     * Set an optional model that computes only the energy, by loading it from a file.  When OpenMM
+     * requests the energy without forces, as happens for Monte Carlo moves and energy reporters, this
+     * model is evaluated instead of the main one.  That avoids the cost of computing forces.  It must
+     * take the same inputs as the main model, and produce the same energy as an output called "energy".
+     *
+     * @param file   the path to the file containing the model
+     */
+    void setEnergyOnlyModel(const std::string& file);
+    /**
+     * Set an optional model that computes only the energy.  When OpenMM requests the energy without
+     * forces, as happens for Monte Carlo moves and energy reporters, this model is evaluated instead of
+     * the main one.  That avoids the cost of computing forces.  It must take the same inputs as the main
+     * model, and produce the same energy as an output called "energy".  Pass an empty vector to remove
+     * it.
+     *
+     * @param model  the binary representation of the model in ONNX format
+     */
+    void setEnergyOnlyModel(const std::vector<uint8_t>& model);
+    /**
+     * Get the number of additional models that are evaluated along with the main one.
+     */
+    int getNumAdditionalModels() const;
+    /**
+     * Get the binary representation of an additional model in ONNX format.
+     *
+     * @param index     the index of the model, between 0 and getNumAdditionalModels()
+     */
+    const std::vector<uint8_t>& getAdditionalModel(int index) const;
+    /**
+     * Add a model that is evaluated along with the main one, by loading it from a file.  Its energy and
+     * forces are added to those of the main model.  This is useful for combining several potentials,
+     * such as a base model and a correction to it.  All the models share the same inputs, so positions
+     * are only copied once, and forces are summed as they are copied out.  This is much faster than
+     * creating a separate OnnxForce for each model.
+     *
+     * An additional model may take any subset of the inputs that are passed to the main model, and must
+     * declare the same types for them.  It must produce outputs called "energy" and "forces".
+     *
+     * @param file   the path to the file containing the model
+     * @return the index of the model that was added
+     */
+    int addAdditionalModel(const std::string& file);
+    /**
+     * Add a model that is evaluated along with the main one.  Its energy and forces are added to those
+     * of the main model.  See the other version of this method for details.
+     *
+     * @param model  the binary representation of the model in ONNX format
+     * @return the index of the model that was added
+     */
+    int addAdditionalModel(const std::vector<uint8_t>& model);
     /**
      * Get the execution provider to be used for computing the model.
      */
@@ -165,6 +242,28 @@ public:
      * @param defaultValue   the default value of the parameter
      */
     void setGlobalParameterDefaultValue(int index, double defaultValue);
+    /**
+     * Request that this force compute the derivative of its energy with respect to a global parameter.
+     * The parameter must be one of the ones added with addGlobalParameter().  The model must then produce
+     * an output called "energyParameterDerivatives" of shape [number of derivatives], containing the
+     * derivatives in the order they were requested.
+     *
+     * @param name             the name of the parameter
+     */
+    void addEnergyParameterDerivative(const std::string& name);
+    /**
+     * Get the number of global parameters with respect to which the derivative of the energy
+     * should be computed.
+     */
+    int getNumEnergyParameterDerivatives() const;
+    /**
+     * Get the name of a global parameter with respect to which this force should compute the
+     * derivative of the energy.
+     *
+     * @param index     the index of the parameter derivative, between 0 and getNumEnergyParameterDerivatives()
+     * @return the parameter name
+     */
+    const std::string& getEnergyParameterDerivativeName(int index) const;
     /**
      * Get the number of extra tensors to pass to the model.
      */
@@ -191,6 +290,63 @@ public:
      * @param index     the index of the input to return
      */
     Input& getInput(int index);
+    /**
+     * Update the values of the extra inputs in a Context to match the current values stored in this
+     * force.  This is much faster than reinitializing the Context, since the model does not need to be
+     * loaded again.  Only the values of inputs can be changed this way.  The shape of each input must
+     * be the same as when the Context was created.  This cannot be used with the "BatchGroup" property.
+     *
+     * @param context   the Context to update
+     */
+    void updateInputsInContext(OpenMM::Context& context);
+    /**
+     * Update the particles this force is applied to in a Context to match the indices currently stored
+     * in this force.  This is much faster than reinitializing the Context, since the model does not need
+     * to be loaded again.  The values of the extra inputs are also updated, and unlike with
+     * updateInputsInContext(), their shapes may change.  That allows inputs with one element per particle
+     * to be updated along with the particles.
+     *
+     * This cannot be used with batched evaluation, multiple devices, or CUDA and HIP graphs, which depend
+     * on the number of particles staying fixed.
+     *
+     * @param context   the Context to update
+     */
+    void updateParticleIndicesInContext(OpenMM::Context& context);
+    /**
+     * Get statistics on how much time has been spent computing this force in a Context.  Timing is only
+     * done if the "EnableTiming" property was set to "true" when the Context was created.  Otherwise the
+     * counts and times are all zero.  The result also contains "sharedSession", which is 1 if this Context
+     * reused a session another Context had already created for the same model and settings, and 0 otherwise.
+     *
+     * The result contains "calls" (the number of times the force was computed) and "evaluations" (the
+     * number of times the model was evaluated, which may be less since results are reused when nothing has
+     * changed).  If the force is part of a batch group, it also contains "batchSize" (the number of
+     * Contexts whose evaluations were combined into the most recent call to the model).  For each phase of
+     * the calculation, it also contains the total time summed over all calls and the time for the most
+     * recent call, in seconds.  For example, "runTotal" and "runLast" are the times spent evaluating the
+     * model.  The phases are "parameters" (looking up global parameters), "gather" (copying positions and
+     * box vectors into the inputs, and updating the neighbor list), "run" (evaluating the model, including
+     * transferring data to and from the device), and "scatter" (copying forces out of the output).
+     *
+     * @param context   the Context to get statistics for
+     */
+    std::map<std::string, double> getTimingStatistics(const OpenMM::Context& context) const;
+    /**
+     * Get the derivatives of the energy with respect to global parameters, as computed the last time forces
+     * were computed in a Context.  The result contains one entry for each parameter that was requested
+     * with addEnergyParameterDerivative().
+     *
+     * @param context   the Context to get derivatives for
+     */
+    std::map<std::string, double> getEnergyParameterDerivatives(const OpenMM::Context& context) const;
+    /**
+     * Get whether this force will be applied on the current time step of a Context.  If the
+     * "EvaluationInterval" property is greater than 1, forces are only applied on steps whose index is a
+     * multiple of it, and are multiplied by the interval.  Otherwise this is always true.
+     *
+     * @param context   the Context to check
+     */
+    bool isEvaluationStep(const OpenMM::Context& context) const;
     /**
      * Set the value of a property.
      *
@@ -206,13 +362,18 @@ public:
 protected:
     OpenMM::ForceImpl* createImpl() const;
 private:
+    friend class OnnxForceImpl;
     class GlobalParameterInfo;
     void initProperties(const std::map<std::string, std::string>& properties);
-    std::vector<uint8_t> model;
+    std::shared_ptr<const std::vector<uint8_t> > model, energyOnlyModel;
+    std::vector<std::shared_ptr<const std::vector<uint8_t> > > additionalModels;
+    std::string modelFile;
+    long long modelFileTime;
     std::vector<int> particleIndices;
     ExecutionProvider provider;
-    bool periodic;
+    bool periodic, serializeModelAsReference;
     std::vector<GlobalParameterInfo> globalParameters;
+    std::vector<std::string> energyParameterDerivatives;
     std::vector<Input*> inputs;
     std::map<std::string, std::string> properties;
 };
@@ -33,13 +33,25 @@
  * -------------------------------------------------------------------------- */
 
 #include "OnnxForce.h"
+#include "OnnxTensorData.h"
 #include "openmm/internal/ContextImpl.h"
 #include "openmm/internal/CustomCPPForceImpl.h"
+#include "openmm/internal/ThreadPool.h"
 #include "onnxruntime_cxx_api.h"
+#include <chrono>
+#include <exception>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <vector>
 
 namespace OnnxPlugin {
 
+class OnnxBatchGroup;
+class OnnxDomainDecomposition;
+class OnnxNeighborList;
+
 /**
  * This is the internal implementation of OnnxForce.
  */
@@ -53,19 +65,101 @@ public:
         return owner;
     }
     std::map<std::string, double> getDefaultParameters();
+    void updateContextState(OpenMM::ContextImpl& context, bool& forcesInvalid);
+    double calcForcesAndEnergy(OpenMM::ContextImpl& context, bool includeForces, bool includeEnergy, int groups);
     double computeForce(OpenMM::ContextImpl& context, const std::vector<OpenMM::Vec3>& positions, std::vector<OpenMM::Vec3>& forces);
+    void updateInputsInContext(OpenMM::ContextImpl& context);
+    void updateParticleIndicesInContext(OpenMM::ContextImpl& context);
+    std::map<std::string, double> getTimingStatistics() const;
+    std::map<std::string, double> getEnergyParameterDerivatives() const;
+    int getEvaluationInterval() const {
+        return evaluationInterval;
+    }
+    /**
+     * Get the size and modification time of a file.  The time is in nanoseconds where the operating
+     * system supports it, so a file that is rewritten within the same second is still detected as changed.
+     *
+     * @param file               the path to the file
+     * @param size               on exit, the size of the file in bytes
+     * @param modificationTime   on exit, the time the file was last modified
+     * @return false if the file does not exist or could not be examined
+     */
+    static bool getFileInfo(const std::string& file, long long& size, long long& modificationTime);
 private:
+    enum Phase {ParametersPhase = 0, GatherPhase = 1, RunPhase = 2, ScatterPhase = 3, NumPhases = 4};
+    /**
+     * This records the information about a model that is evaluated along with the main one.  It
+     * uses the same input tensors, but has its own outputs.
+     */
+    struct AdditionalModel {
+        AdditionalModel() : binding(nullptr) {
+        }
+        std::shared_ptr<Ort::Session> session;
+        Ort::IoBinding binding;
+        OnnxTensorData energyData, forceData;
+        std::vector<Ort::Value> outputTensors;
+        std::vector<bool> usesInput, inputChanged;
+    };
     const OnnxForce& owner;
+    void loadParticleIndices(int numSystemParticles);
+    void loadExtraInputs(bool allowShapeChange);
+    void setInputs(OpenMM::ContextImpl& context, const std::vector<OpenMM::Vec3>& positions);
+    bool inputsMatch(OpenMM::ContextImpl& context, const std::vector<OpenMM::Vec3>& positions);
+    void evaluateModel(bool includeForces);
+    void forEachBlock(const std::function<void (int, int)>& task);
+    void updateNeighborList(const std::vector<OpenMM::Vec3>& positions);
+    void markInputChanged(int index);
+    int findInput(const std::string& name);
+    std::chrono::steady_clock::time_point startTimer() const;
+    void stopTimer(Phase phase, std::chrono::steady_clock::time_point start);
+    void waitForAsyncEvaluation();
+    void warmup(OpenMM::ContextImpl& context);
     void validateInput(const std::string& name, const std::vector<int>& shape, int size);
-    Ort::Env env;
-    Ort::Session session;
+    ONNXTensorElementDataType getInputType(const std::string& name, bool floatingPoint);
+    static ONNXTensorElementDataType getOutputType(Ort::Session& model, const std::string& name);
+    static std::vector<int64_t> getOutputShape(Ort::Session& model, const std::string& name);
+    static Ort::SessionOptions createSessionOptions(const OnnxForce& owner, const std::string& deviceIndex, int platformThreads,
+            const std::string& profileShapes, std::vector<OnnxForce::ExecutionProvider>& providers);
+    static std::shared_ptr<Ort::Session> createSession(const std::vector<uint8_t>& model, const std::string& modelFile, Ort::SessionOptions& options,
+            const std::string& optimizedModelFile);
+    static std::shared_ptr<Ort::Session> getSession(const std::vector<uint8_t>& model, const std::string& modelFile, const std::string& key,
+            Ort::SessionOptions& options, const std::string& optimizedModelFile);
+    std::shared_ptr<Ort::Session> session;
+    std::shared_ptr<OnnxBatchGroup> batchGroup;
+    std::unique_ptr<OnnxDomainDecomposition> domains;
+    Ort::IoBinding binding;
     std::vector<Ort::Value> inputTensors, outputTensors;
     std::vector<const char*> inputNames;
+    int numDynamicInputs;
     std::vector<int> particleIndices;
-    std::vector<float> positionVec, paramVec;
-    std::vector<OnnxForce::IntegerInput> integerInputs;
-    std::vector<OnnxForce::FloatInput> floatInputs;
-    float boxVectors[9];
+    bool contiguousIndices;
+    std::unique_ptr<OpenMM::ThreadPool> conversionThreads;
+    OnnxTensorData positionData, boxData, energyData, forceData, derivativeData;
+    std::vector<OnnxTensorData> paramData, extraInputData;
+    std::unique_ptr<OnnxNeighborList> neighborList;
+    OnnxTensorData neighborData, shiftData;
+    int neighborInputIndex;
+    bool hasNeighborShifts;
+    std::vector<OpenMM::Vec3> lastPositions;
+    OpenMM::Vec3 lastBox[3];
+    std::vector<double> lastParams;
+    std::vector<const double*> paramValues;
+    std::vector<bool> inputChanged, energyInputChanged;
+    std::vector<double> parameterDerivatives;
+    bool resultValid, energyValid, forcesRequested, energyRequested, clearForces;
+    bool sharedSession;
+    int evaluationInterval;
+    std::shared_ptr<Ort::Session> energySession;
+    Ort::IoBinding energyBinding;
+    std::vector<AdditionalModel> additionalModels;
+    std::unique_ptr<OpenMM::ThreadPool> asyncThread;
+    std::vector<OpenMM::Vec3> asyncPositions;
+    std::exception_ptr asyncError;
+    bool asyncPending;
+    bool enableTiming;
+    int numCalls, numEvaluations, lastBatchSize;
+    double totalTime[NumPhases], lastTime[NumPhases];
+    mutable std::mutex timingMutex;
 };
 
 } // namespace OnnxPlugin
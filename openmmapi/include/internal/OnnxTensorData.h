@@ -0,0 +1,145 @@
+#ifndef OPENMM_ONNXTENSORDATA_H_
+#define OPENMM_ONNXTENSORDATA_H_
+
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2025 Stanford University and the Authors.           *
+ * Authors: Peter Eastman                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+#include "openmm/Vec3.h"
+#include "onnxruntime_cxx_api.h"
+#include <string>
+#include <vector>
+
+namespace OnnxPlugin {
+
+/**
+ * This class holds the data for a tensor that is passed to or returned by a model.  The values are stored
+ * in whatever element type the model uses for that tensor, and are converted to and from the types used
+ * by OpenMM.
+ */
+
+class OnnxTensorData {
+public:
+    OnnxTensorData() : type(ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT), size(0) {
+    }
+    /**
+     * Set the element type and number of elements.  The contents are undefined after this is called.
+     * Memory is only reallocated when the data grows beyond its current capacity.
+     */
+    void resize(ONNXTensorElementDataType type, size_t size);
+    /**
+     * Get the element type.
+     */
+    ONNXTensorElementDataType getType() const {
+        return type;
+    }
+    /**
+     * Get the number of elements.
+     */
+    size_t getSize() const {
+        return size;
+    }
+    /**
+     * Get the number of bytes occupied by the elements.
+     */
+    size_t getBytes() const {
+        return size*getElementSize(type);
+    }
+    void* getData() {
+        return storage.data();
+    }
+    const void* getData() const {
+        return storage.data();
+    }
+    /**
+     * Create an Ort::Value that wraps this data.  The data must not be resized while the Value exists.
+     */
+    Ort::Value createTensor(const OrtMemoryInfo* memoryInfo, const std::vector<int64_t>& shape);
+    /**
+     * Set a single element.
+     */
+    void setValue(size_t index, double value);
+    /**
+     * Get a single element.
+     */
+    double getValue(size_t index) const;
+    /**
+     * Set the elements from an array of floats, converting them to the element type.
+     */
+    void setValues(const float* values, size_t count);
+    /**
+     * Set the elements from an array of ints, converting them to the element type.
+     */
+    void setValues(const int* values, size_t count);
+    /**
+     * Set elements from a subset of a list of vectors.  For each i in [start, end), elements 3*i to 3*i+2
+     * are set to the components of vectors[indices[i]].
+     *
+     * @param vectors     the vectors to copy from
+     * @param indices     the index of the vector corresponding to each group of three elements
+     * @param contiguous  if true, indices is known to be a contiguous range with indices[i] = indices[0]+i.
+     *                    The data is then converted as a single flat array, which is much faster.
+     * @param start       the first value of i to process
+     * @param end         the value of i to stop at
+     */
+    void gatherVectors(const std::vector<OpenMM::Vec3>& vectors, const std::vector<int>& indices, bool contiguous, int start, int end);
+    /**
+     * Copy elements into a subset of a list of vectors.  For each i in [start, end), vectors[indices[i]]
+     * is set to elements 3*i to 3*i+2.  The arguments have the same meaning as for gatherVectors().
+     */
+    void scatterVectors(std::vector<OpenMM::Vec3>& vectors, const std::vector<int>& indices, bool contiguous, int start, int end) const;
+    /**
+     * Add elements to a subset of a list of vectors.  This is the same as scatterVectors(), except that
+     * the elements are added to the vectors instead of replacing them.
+     */
+    void addToVectors(std::vector<OpenMM::Vec3>& vectors, const std::vector<int>& indices, int start, int end) const;
+    /**
+     * Get the size in bytes of an element type.  This throws an exception if the type is not supported.
+     */
+    static size_t getElementSize(ONNXTensorElementDataType type);
+    /**
+     * Get whether an element type is a floating point type.
+     */
+    static bool isFloatingPoint(ONNXTensorElementDataType type);
+    /**
+     * Get a human readable name for an element type.
+     */
+    static std::string getTypeName(ONNXTensorElementDataType type);
+private:
+    ONNXTensorElementDataType type;
+    size_t size;
+    // This is declared as double to ensure correct alignment for every element type.  It always
+    // contains at least one element, so tensors with no elements still have a valid data pointer.
+    std::vector<double> storage;
+};
+
+} // namespace OnnxPlugin
+
+#endif /*OPENMM_ONNXTENSORDATA_H_*/
@@ -0,0 +1,154 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2025 Stanford University and the Authors.           *
+ * Authors: Peter Eastman                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+
+#include "OnnxBatchGroup.h"
+#include <algorithm>
+#include <cstring>
+
+using namespace OnnxPlugin;
+using namespace std;
+using namespace Ort;
+
+OnnxBatchGroup::OnnxBatchGroup(shared_ptr<Session> session, int numParticles, bool periodic, const vector<string>& parameterNames,
+            int maxBatchSize, int timeoutMicroseconds) : session(session), numParticles(numParticles), maxBatchSize(maxBatchSize),
+            periodic(periodic), parameterNames(parameterNames), timeout(timeoutMicroseconds) {
+}
+
+int OnnxBatchGroup::compute(const OnnxTensorData& positions, const OnnxTensorData& box, const vector<OnnxTensorData>& parameters,
+            const char* const* extraNames, const Value* extraInputs, int numExtraInputs, OnnxTensorData& energy, OnnxTensorData& forces) {
+    Request request = {&positions, &box, &parameters, extraNames, extraInputs, numExtraInputs, &energy, &forces, 0, false, nullptr};
+    unique_lock<mutex> guard(lock);
+    pending.push_back(&request);
+    auto deadline = chrono::steady_clock::now()+timeout;
+    while (!request.done) {
+        auto position = find(pending.begin(), pending.end(), &request);
+        bool queued = (position != pending.end());
+        if (queued && (pending.size() >= maxBatchSize || chrono::steady_clock::now() >= deadline)) {
+            // This thread evaluates the batch.  It always includes its own request, followed by the
+            // oldest other ones.
+
+            vector<Request*> batch = {&request};
+            pending.erase(position);
+            while (batch.size() < maxBatchSize && pending.size() > 0) {
+                batch.push_back(pending.front());
+                pending.erase(pending.begin());
+            }
+            guard.unlock();
+            computeBatch(batch);
+            guard.lock();
+            for (Request* r : batch) {
+                r->batchSize = batch.size();
+                r->done = true;
+            }
+            condition.notify_all();
+        }
+        else if (queued)
+            condition.wait_until(guard, deadline);
+        else
+            condition.wait(guard);
+    }
+    if (request.error)
+        rethrow_exception(request.error);
+    return request.batchSize;
+}
+
+void OnnxBatchGroup::computeBatch(const vector<Request*>& batch) {
+    try {
+        // Assemble the batched inputs.  Each request's data is copied as raw bytes, since all requests
+        // use the same element types.
+
+        int batchSize = batch.size();
+        int numParameters = parameterNames.size();
+        const Request& first = *batch[0];
+        OnnxTensorData positionData, boxData;
+        vector<OnnxTensorData> paramData(numParameters);
+        positionData.resize(first.positions->getType(), batchSize*numParticles*3);
+        size_t positionBytes = first.positions->getBytes();
+        if (periodic)
+            boxData.resize(first.box->getType(), batchSize*9);
+        size_t boxBytes = first.box->getBytes();
+        for (int j = 0; j < numParameters; j++)
+            paramData[j].resize((*first.parameters)[j].getType(), batchSize);
+        for (int i = 0; i < batchSize; i++) {
+            memcpy((char*) positionData.getData()+i*positionBytes, batch[i]->positions->getData(), positionBytes);
+            if (periodic)
+                memcpy((char*) boxData.getData()+i*boxBytes, batch[i]->box->getData(), boxBytes);
+            for (int j = 0; j < numParameters; j++) {
+                const OnnxTensorData& param = (*batch[i]->parameters)[j];
+                memcpy((char*) paramData[j].getData()+i*param.getBytes(), param.getData(), param.getBytes());
+            }
+        }
+        auto memoryInfo = MemoryInfo::CreateCpu(OrtDeviceAllocator, OrtMemTypeCPU);
+        vector<Value> inputs;
+        vector<const char*> names;
+        inputs.emplace_back(positionData.createTensor(memoryInfo, {batchSize, numParticles, 3}));
+        names.push_back("positions");
+        if (periodic) {
+            inputs.emplace_back(boxData.createTensor(memoryInfo, {batchSize, 3, 3}));
+            names.push_back("box");
+        }
+        for (int j = 0; j < numParameters; j++) {
+            inputs.emplace_back(paramData[j].createTensor(memoryInfo, {batchSize}));
+            names.push_back(parameterNames[j].c_str());
+        }
+
+        // Extra inputs are the same for every request in the group, so take them from the first one.  They are views of
+        // buffers owned by that request's OnnxForceImpl, so we create new views of the same data.
+
+        for (int j = 0; j < batch[0]->numExtraInputs; j++) {
+            const Value& input = batch[0]->extraInputs[j];
+            auto info = input.GetTensorTypeAndShapeInfo();
+            vector<int64_t> shape = info.GetShape();
+            size_t bytes = info.GetElementCount()*OnnxTensorData::getElementSize(info.GetElementType());
+            inputs.emplace_back(Value::CreateTensor(memoryInfo, const_cast<void*>(input.GetTensorData<void>()), bytes, shape.data(), shape.size(), info.GetElementType()));
+            names.push_back(batch[0]->extraNames[j]);
+        }
+
+        // Evaluate the model and distribute the results.
+
+        const char* outputNames[] = {"energy", "forces"};
+        vector<Value> outputs = session->Run(RunOptions{nullptr}, names.data(), inputs.data(), inputs.size(), outputNames, 2);
+        const char* energy = outputs[0].GetTensorData<char>();
+        const char* forces = outputs[1].GetTensorData<char>();
+        size_t energyBytes = first.energy->getBytes();
+        size_t forceBytes = first.forces->getBytes();
+        for (int i = 0; i < batchSize; i++) {
+            memcpy(batch[i]->energy->getData(), energy+i*energyBytes, energyBytes);
+            memcpy(batch[i]->forces->getData(), forces+i*forceBytes, forceBytes);
+        }
+    }
+    catch (...) {
+        exception_ptr error = current_exception();
+        for (Request* r : batch)
+            r->error = error;
+    }
+}
@@ -0,0 +1,113 @@
+#ifndef OPENMM_ONNXBATCHGROUP_H_
+#define OPENMM_ONNXBATCHGROUP_H_
+
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2025 Stanford University and the Authors.           *
+ * Authors: Peter Eastman                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+#include "internal/OnnxTensorData.h"
+#include "onnxruntime_cxx_api.h"
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace OnnxPlugin {
+
+/**
+ * This class combines evaluations of the same model from several OnnxForceImpls into a single
+ * call to Session::Run().  Each Context calls compute() from its own thread.  The call blocks until
+ * a batch containing the request has been evaluated.  A batch is evaluated as soon as enough requests
+ * have arrived, or when the oldest request in it has waited longer than the timeout.
+ *
+ * The model must accept a leading batch dimension on every input that varies between requests: positions
+ * have shape [B, N, 3], box vectors have shape [B, 3, 3], and each global parameter has shape [B].  It
+ * must produce an energy of shape [B] and forces of shape [B, N, 3].  Extra inputs are not batched, so
+ * every request must have the same values for them.  OnnxForceImpl ensures that by only putting forces
+ * with identical extra inputs in the same group.  Every request must use the same element types, which
+ * are the ones the model declares.
+ */
+
+class OnnxBatchGroup {
+public:
+    OnnxBatchGroup(std::shared_ptr<Ort::Session> session, int numParticles, bool periodic, const std::vector<std::string>& parameterNames,
+                   int maxBatchSize, int timeoutMicroseconds);
+    /**
+     * Evaluate the model for one set of inputs, blocking until the result is available.
+     *
+     * @param positions      the particle positions, of length 3*numParticles
+     * @param box            the periodic box vectors, of length 9.  This is ignored if the model is not periodic.
+     * @param parameters     the values of the global parameters, each of length 1
+     * @param extraNames     the names of the extra inputs
+     * @param extraInputs    the values of the extra inputs
+     * @param numExtraInputs the number of extra inputs
+     * @param energy         on exit, this contains the potential energy.  It must have length 1.
+     * @param forces         on exit, this contains the forces.  It must have length 3*numParticles.
+     * @return the number of requests that were evaluated together in the batch containing this one
+     */
+    int compute(const OnnxTensorData& positions, const OnnxTensorData& box, const std::vector<OnnxTensorData>& parameters,
+                 const char* const* extraNames, const Ort::Value* extraInputs, int numExtraInputs, OnnxTensorData& energy,
+                 OnnxTensorData& forces);
+private:
+    struct Request;
+    void computeBatch(const std::vector<Request*>& batch);
+    std::shared_ptr<Ort::Session> session;
+    int numParticles, maxBatchSize;
+    bool periodic;
+    std::vector<std::string> parameterNames;
+    std::chrono::microseconds timeout;
+    std::mutex lock;
+    std::condition_variable condition;
+    std::vector<Request*> pending;
+};
+
+/**
+ * This records the inputs and results for one call to compute().
+ */
+struct OnnxBatchGroup::Request {
+    const OnnxTensorData* positions;
+    const OnnxTensorData* box;
+    const std::vector<OnnxTensorData>* parameters;
+    const char* const* extraNames;
+    const Ort::Value* extraInputs;
+    int numExtraInputs;
+    OnnxTensorData* energy;
+    OnnxTensorData* forces;
+    int batchSize;
+    bool done;
+    std::exception_ptr error;
+};
+
+} // namespace OnnxPlugin
+
+#endif /*OPENMM_ONNXBATCHGROUP_H_*/
@@ -0,0 +1,211 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2025 Stanford University and the Authors.           *
+ * Authors: Peter Eastman                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+
+#include "OnnxDomainDecomposition.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+using namespace OnnxPlugin;
+using namespace OpenMM;
+using namespace std;
+using namespace Ort;
+
+OnnxDomainDecomposition::OnnxDomainDecomposition(const vector<shared_ptr<Session> >& sessions, const vector<Input>& inputs,
+            int numParticles, double haloWidth, bool periodic, ONNXTensorElementDataType maskType, const vector<int64_t>& energyShape) :
+            inputs(inputs), domains(sessions.size()), numParticles(numParticles), haloWidth(haloWidth), periodic(periodic),
+            maskType(maskType), energyShape(energyShape), threads(sessions.size()) {
+    for (int i = 0; i < sessions.size(); i++) {
+        domains[i].session = sessions[i];
+        domains[i].inputData.resize(inputs.size());
+    }
+}
+
+void OnnxDomainDecomposition::compute(const vector<Vec3>& positions, const Vec3* box, OnnxTensorData& energy, OnnxTensorData& forces) {
+    // Evaluate all the domains in parallel.
+
+    findDomains(positions, box);
+    threads.execute([&] (ThreadPool& pool, int threadIndex) {
+        computeDomain(domains[threadIndex], energy.getType(), forces.getType());
+    });
+    threads.waitForThreads();
+
+    // Sum the results.
+
+    double totalEnergy = 0;
+    vector<double> totalForces(3*numParticles, 0.0);
+    for (Domain& domain : domains) {
+        if (domain.error) {
+            exception_ptr error = domain.error;
+            domain.error = nullptr;
+            rethrow_exception(error);
+        }
+        if (domain.particles.size() == 0)
+            continue;
+        totalEnergy += domain.energy.getValue(0);
+        for (int i = 0; i < domain.particles.size(); i++)
+            for (int j = 0; j < 3; j++)
+                totalForces[3*domain.particles[i]+j] += domain.forces.getValue(3*i+j);
+    }
+    energy.setValue(0, totalEnergy);
+    for (int i = 0; i < 3*numParticles; i++)
+        forces.setValue(i, totalForces[i]);
+}
+
+void OnnxDomainDecomposition::findDomains(const vector<Vec3>& positions, const Vec3* box) {
+    // Choose the axis to divide along.  With periodic boundary conditions it is always z, since planes of
+    // constant z are parallel to the first two box vectors.  Otherwise it is the axis along which the
+    // particles are most spread out.
+
+    int axis = 2;
+    double width = 0;
+    if (periodic)
+        width = box[2][2];
+    else {
+        Vec3 minPos = positions[0], maxPos = positions[0];
+        for (const Vec3& pos : positions)
+            for (int j = 0; j < 3; j++) {
+                minPos[j] = min(minPos[j], pos[j]);
+                maxPos[j] = max(maxPos[j], pos[j]);
+            }
+        Vec3 extent = maxPos-minPos;
+        if (extent[0] >= extent[1] && extent[0] >= extent[2])
+            axis = 0;
+        else if (extent[1] >= extent[2])
+            axis = 1;
+    }
+    vector<double> coord(numParticles);
+    vector<int> order(numParticles);
+    for (int i = 0; i < numParticles; i++) {
+        coord[i] = positions[i][axis];
+        if (periodic)
+            coord[i] -= floor(coord[i]/width)*width;
+        order[i] = i;
+    }
+    sort(order.begin(), order.end(), [&] (int a, int b) { return coord[a] < coord[b]; });
+
+    // Each domain owns a contiguous range of particles in this order.  Its halo consists of the particles
+    // on either side of the range that are within the halo width.  With periodic boundary conditions, the
+    // search wraps around the ends of the box.
+
+    int numDomains = domains.size();
+    for (int d = 0; d < numDomains; d++) {
+        Domain& domain = domains[d];
+        int begin = (d*numParticles)/numDomains;
+        int end = ((d+1)*numParticles)/numDomains;
+        domain.particles.assign(order.begin()+begin, order.begin()+end);
+        domain.numOwned = end-begin;
+        if (begin == end)
+            continue;
+        int maxHalo = numParticles-domain.numOwned;
+        double lower = coord[order[begin]];
+        double upper = coord[order[end-1]];
+        int numHalo = 0;
+        for (int i = 1; numHalo < maxHalo; i++) {
+            int index = begin-i;
+            double offset = 0;
+            if (index < 0) {
+                if (!periodic)
+                    break;
+                index += numParticles;
+                offset = width;
+            }
+            if (lower-coord[order[index]]+offset > haloWidth)
+                break;
+            domain.particles.push_back(order[index]);
+            numHalo++;
+        }
+        for (int i = 0; numHalo < maxHalo; i++) {
+            int index = end+i;
+            double offset = 0;
+            if (index >= numParticles) {
+                if (!periodic)
+                    break;
+                index -= numParticles;
+                offset = width;
+            }
+            if (coord[order[index]]+offset-upper > haloWidth)
+                break;
+            domain.particles.push_back(order[index]);
+            numHalo++;
+        }
+    }
+}
+
+void OnnxDomainDecomposition::computeDomain(Domain& domain, ONNXTensorElementDataType energyType, ONNXTensorElementDataType forceType) {
+    int count = domain.particles.size();
+    if (count == 0)
+        return;
+    try {
+        // Assemble the inputs.  Per-particle inputs are copied row by row as raw bytes.  Other inputs are
+        // the same for every domain, so we create views of the shared data.
+
+        auto memoryInfo = MemoryInfo::CreateCpu(OrtDeviceAllocator, OrtMemTypeCPU);
+        vector<Value> values;
+        vector<const char*> names;
+        for (int i = 0; i < inputs.size(); i++) {
+            const Input& input = inputs[i];
+            if (input.perParticle) {
+                OnnxTensorData& data = domain.inputData[i];
+                size_t rowSize = input.data->getSize()/numParticles;
+                size_t rowBytes = input.data->getBytes()/numParticles;
+                data.resize(input.data->getType(), rowSize*count);
+                for (int j = 0; j < count; j++)
+                    memcpy((char*) data.getData()+j*rowBytes, (const char*) input.data->getData()+domain.particles[j]*rowBytes, rowBytes);
+                vector<int64_t> shape = input.shape;
+                shape[0] = count;
+                values.emplace_back(data.createTensor(memoryInfo, shape));
+            }
+            else
+                values.emplace_back(input.data->createTensor(memoryInfo, input.shape));
+            names.push_back(input.name);
+        }
+        domain.mask.resize(maskType, count);
+        for (int i = 0; i < count; i++)
+            domain.mask.setValue(i, i < domain.numOwned ? 1 : 0);
+        values.emplace_back(domain.mask.createTensor(memoryInfo, {count}));
+        names.push_back("ownedParticles");
+
+        // Evaluate the model.
+
+        domain.energy.resize(energyType, 1);
+        domain.forces.resize(forceType, 3*count);
+        vector<Value> outputs;
+        outputs.emplace_back(domain.energy.createTensor(memoryInfo, energyShape));
+        outputs.emplace_back(domain.forces.createTensor(memoryInfo, {count, 3}));
+        const char* outputNames[] = {"energy", "forces"};
+        domain.session->Run(RunOptions{nullptr}, names.data(), values.data(), values.size(), outputNames, outputs.data(), 2);
+    }
+    catch (...) {
+        domain.error = current_exception();
+    }
+}
@@ -0,0 +1,117 @@
+#ifndef OPENMM_ONNXDOMAINDECOMPOSITION_H_
+#define OPENMM_ONNXDOMAINDECOMPOSITION_H_
+
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2025 Stanford University and the Authors.           *
+ * Authors: Peter Eastman                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+#include "internal/OnnxTensorData.h"
+#include "openmm/Vec3.h"
+#include "openmm/internal/ThreadPool.h"
+#include "onnxruntime_cxx_api.h"
+#include <exception>
+#include <memory>
+#include <vector>
+
+namespace OnnxPlugin {
+
+/**
+ * This class divides the particles into spatial domains and evaluates each one with a different session,
+ * usually on a different device.  The domains are slabs along one axis containing equal numbers of
+ * particles.  Each domain also includes a halo of particles within a specified distance of it.  All
+ * domains are evaluated concurrently, and their energies and forces are summed.
+ *
+ * The model must have an extra input called "ownedParticles" of shape [N].  It is 1 for particles that
+ * belong to the domain and 0 for particles in the halo.  The model must return only the part of the
+ * energy assigned to the owned particles, and the forces on all N particles that result from it.  This
+ * gives exact results as long as the energy assigned to each particle only depends on particles within
+ * the halo width.
+ */
+
+class OnnxDomainDecomposition {
+public:
+    /**
+     * This describes one input to the model.  If perParticle is true, the first dimension of the input
+     * corresponds to particles, and each domain receives only the rows for its own particles.  Otherwise
+     * every domain receives the whole input.
+     */
+    struct Input {
+        const char* name;
+        OnnxTensorData* data;
+        std::vector<int64_t> shape;
+        bool perParticle;
+    };
+    /**
+     * Create an OnnxDomainDecomposition.
+     *
+     * @param sessions      the session to use for each domain
+     * @param inputs        the inputs to the model, excluding ownedParticles
+     * @param numParticles  the number of particles the model is applied to
+     * @param haloWidth     the width of the halo around each domain
+     * @param periodic      whether to use periodic boundary conditions
+     * @param maskType      the element type of the ownedParticles input
+     * @param energyShape   the shape of the energy output
+     */
+    OnnxDomainDecomposition(const std::vector<std::shared_ptr<Ort::Session> >& sessions, const std::vector<Input>& inputs,
+                            int numParticles, double haloWidth, bool periodic, ONNXTensorElementDataType maskType,
+                            const std::vector<int64_t>& energyShape);
+    /**
+     * Evaluate the model for all domains and combine the results.
+     *
+     * @param positions  the positions of the particles the model is applied to
+     * @param box        the periodic box vectors.  This is ignored if periodic boundary conditions are not used.
+     * @param energy     on exit, this contains the total potential energy.  It must have length 1.
+     * @param forces     on exit, this contains the total forces.  It must have length 3*numParticles.
+     */
+    void compute(const std::vector<OpenMM::Vec3>& positions, const OpenMM::Vec3* box, OnnxTensorData& energy, OnnxTensorData& forces);
+private:
+    struct Domain {
+        std::shared_ptr<Ort::Session> session;
+        std::vector<int> particles;
+        int numOwned;
+        std::vector<OnnxTensorData> inputData;
+        OnnxTensorData mask, energy, forces;
+        std::exception_ptr error;
+    };
+    void findDomains(const std::vector<OpenMM::Vec3>& positions, const OpenMM::Vec3* box);
+    void computeDomain(Domain& domain, ONNXTensorElementDataType energyType, ONNXTensorElementDataType forceType);
+    std::vector<Input> inputs;
+    std::vector<Domain> domains;
+    int numParticles;
+    double haloWidth;
+    bool periodic;
+    ONNXTensorElementDataType maskType;
+    std::vector<int64_t> energyShape;
+    OpenMM::ThreadPool threads;
+};
+
+} // namespace OnnxPlugin
+
+#endif /*OPENMM_ONNXDOMAINDECOMPOSITION_H_*/
@@ -35,20 +35,58 @@
 #include "openmm/internal/AssertionUtilities.h"
 #include <iostream>
 #include <fstream>
+#include <mutex>
+#include <sstream>
 
 using namespace OnnxPlugin;
 using namespace OpenMM;
 using namespace std;
 
-OnnxForce::OnnxForce(const string& file, const map<string, string>& properties) : provider(Default), periodic(false) {
-    ifstream input(file, ios::in | ios::binary);
-    if (!input.good())
+/**
+ * Models loaded from files are cached, so that forces loading the same file share a single copy of it.
+ * The key includes the size and modification time (with nanosecond resolution where available), so a file
+ * that has been changed is loaded again.
+ */
+static mutex modelCacheMutex;
+static map<string, weak_ptr<const vector<uint8_t> > > modelCache;
+
+static shared_ptr<const vector<uint8_t> > loadModel(const string& file, long long& modificationTime) {
+    long long size;
+    if (!OnnxForceImpl::getFileInfo(file, size, modificationTime))
         throw OpenMMException("Failed to read file "+file);
-    model = vector<uint8_t>((istreambuf_iterator<char>(input)), istreambuf_iterator<char>());
+    stringstream key;
+    key<<file<<":"<<size<<":"<<modificationTime;
+    lock_guard<mutex> lock(modelCacheMutex);
+    shared_ptr<const vector<uint8_t> > model = modelCache[key.str()].lock();
+    if (!model) {
+        // Read the whole file with a single call, rather than one character at a time.
+
+        ifstream input(file, ios::in | ios::binary);
+        if (!input.good())
+            throw OpenMMException("Failed to read file "+file);
+        shared_ptr<vector<uint8_t> > data = make_shared<vector<uint8_t> >(size);
+        if (!input.read(reinterpret_cast<char*>(data->data()), data->size()))
+            throw OpenMMException("Failed to read file "+file);
+        for (auto iter = modelCache.begin(); iter != modelCache.end(); ) {
+            if (iter->second.expired())
+                iter = modelCache.erase(iter);
+            else
+                ++iter;
+        }
+        model = data;
+        modelCache[key.str()] = model;
+    }
+    return model;
+}
+
+OnnxForce::OnnxForce(const string& file, const map<string, string>& properties) : energyOnlyModel(make_shared<vector<uint8_t> >()),
+        modelFile(file), provider(Default), periodic(false), serializeModelAsReference(false) {
+    model = loadModel(file, modelFileTime);
     initProperties(properties);
 }
 
-OnnxForce::OnnxForce(const std::vector<uint8_t>& model, const map<string, string>& properties) : model(model), provider(Default), periodic(false)  {
+OnnxForce::OnnxForce(const std::vector<uint8_t>& model, const map<string, string>& properties) : model(make_shared<vector<uint8_t> >(model)),
+        energyOnlyModel(make_shared<vector<uint8_t> >()), modelFileTime(0), provider(Default), periodic(false), serializeModelAsReference(false) {
     initProperties(properties);
 }
 
@@ -58,7 +96,15 @@ OnnxForce::~OnnxForce() {
 }
 
 void OnnxForce::initProperties(const std::map<std::string, std::string>& properties) {
-    const std::map<std::string, std::string> defaultProperties = {{"UseGraphs", "false"}, {"DeviceIndex", "0"}};
+    const std::map<std::string, std::string> defaultProperties = {{"UseGraphs", "false"}, {"DeviceIndex", "0"},
+            {"TensorRTEngineCachePath", ""}, {"TensorRTTimingCachePath", ""}, {"TensorRTPrecision", "fp32"},
+            {"IntraOpThreads", "0"}, {"InterOpThreads", "0"}, {"IntraOpThreadAffinity", ""}, {"GraphOptimizationLevel", "all"},
+            {"ExecutionMode", "sequential"}, {"EnableMemoryPattern", "true"}, {"EnableCpuMemArena", "true"},
+            {"OptimizedModelCachePath", ""}, {"BatchGroup", ""}, {"BatchSize", "8"}, {"BatchTimeout", "1000"},
+            {"AsyncEvaluation", "false"}, {"ConversionThreads", "1"},
+            {"NeighborCutoff", "0"}, {"NeighborSkin", "0.1"}, {"DomainHaloWidth", "0"},
+            {"EnableTiming", "false"}, {"ProfilingFilePrefix", ""}, {"GlobalThreadPool", "false"}, {"AllowSpinning", "auto"},
+            {"Warmup", "false"}, {"TensorRTFixedShapes", "false"}, {"EvaluationInterval", "1"}};
     this->properties = defaultProperties;
     for (auto& property : properties) {
         if (defaultProperties.find(property.first) == defaultProperties.end())
@@ -68,7 +114,54 @@ void OnnxForce::initProperties(const std::map<std::string, std::string>& propert
 }
 
 const std::vector<uint8_t>& OnnxForce::getModel() const {
-    return model;
+    return *model;
+}
+
+const vector<uint8_t>& OnnxForce::getEnergyOnlyModel() const {
+    return *energyOnlyModel;
+}
+
+void OnnxForce::setEnergyOnlyModel(const string& file) {
+    long long modificationTime;
+    energyOnlyModel = loadModel(file, modificationTime);
+}
+
+void OnnxForce::setEnergyOnlyModel(const vector<uint8_t>& model) {
+    energyOnlyModel = make_shared<vector<uint8_t> >(model);
+}
+
+int OnnxForce::getNumAdditionalModels() const {
+    return additionalModels.size();
+}
+
+const vector<uint8_t>& OnnxForce::getAdditionalModel(int index) const {
+    ASSERT_VALID_INDEX(index, additionalModels);
+    return *additionalModels[index];
+}
+
+int OnnxForce::addAdditionalModel(const string& file) {
+    long long modificationTime;
+    additionalModels.push_back(loadModel(file, modificationTime));
+    return additionalModels.size()-1;
+}
+
+int OnnxForce::addAdditionalModel(const vector<uint8_t>& model) {
+    additionalModels.push_back(make_shared<vector<uint8_t> >(model));
+    return additionalModels.size()-1;
+}
+
+const string& OnnxForce::getModelFile() const {
+    return modelFile;
+}
+
+bool OnnxForce::getSerializeModelAsReference() const {
+    return serializeModelAsReference;
+}
+
+void OnnxForce::setSerializeModelAsReference(bool reference) {
+    if (reference && modelFile.size() == 0)
+        throw OpenMMException("OnnxForce: the model can only be serialized as a reference if it was loaded from a file");
+    serializeModelAsReference = reference;
 }
 
 OnnxForce::ExecutionProvider OnnxForce::getExecutionProvider() const {
@@ -128,6 +221,19 @@ void OnnxForce::setGlobalParameterDefaultValue(int index, double defaultValue) {
     globalParameters[index].defaultValue = defaultValue;
 }
 
+void OnnxForce::addEnergyParameterDerivative(const string& name) {
+    energyParameterDerivatives.push_back(name);
+}
+
+int OnnxForce::getNumEnergyParameterDerivatives() const {
+    return energyParameterDerivatives.size();
+}
+
+const string& OnnxForce::getEnergyParameterDerivativeName(int index) const {
+    ASSERT_VALID_INDEX(index, energyParameterDerivatives);
+    return energyParameterDerivatives[index];
+}
+
 int OnnxForce::getNumInputs() const {
     return inputs.size();
 }
@@ -147,6 +253,27 @@ OnnxForce::Input& OnnxForce::getInput(int index) {
     return *inputs[index];
 }
 
+void OnnxForce::updateInputsInContext(Context& context) {
+    dynamic_cast<OnnxForceImpl&>(getImplInContext(context)).updateInputsInContext(getContextImpl(context));
+}
+
+void OnnxForce::updateParticleIndicesInContext(Context& context) {
+    dynamic_cast<OnnxForceImpl&>(getImplInContext(context)).updateParticleIndicesInContext(getContextImpl(context));
+}
+
+map<string, double> OnnxForce::getTimingStatistics(const Context& context) const {
+    return dynamic_cast<const OnnxForceImpl&>(getImplInContext(context)).getTimingStatistics();
+}
+
+map<string, double> OnnxForce::getEnergyParameterDerivatives(const Context& context) const {
+    return dynamic_cast<const OnnxForceImpl&>(getImplInContext(context)).getEnergyParameterDerivatives();
+}
+
+bool OnnxForce::isEvaluationStep(const Context& context) const {
+    int interval = dynamic_cast<const OnnxForceImpl&>(getImplInContext(context)).getEvaluationInterval();
+    return (context.getStepCount()%interval == 0);
+}
+
 void OnnxForce::setProperty(const string& name, const string& value) {
     if (properties.find(name) == properties.end())
         throw OpenMMException("OnnxForce: Unknown property '" + name + "'");
@@ -30,19 +30,134 @@
  * -------------------------------------------------------------------------- */
 
 #include "internal/OnnxForceImpl.h"
+#include "OnnxBatchGroup.h"
+#include "OnnxDomainDecomposition.h"
+#include "OnnxNeighborList.h"
 #include "openmm/OpenMMException.h"
 #include "openmm/internal/ContextImpl.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <limits>
+#include <mutex>
+#include <random>
 #include <sstream>
+#include <sys/stat.h>
 
 using namespace OnnxPlugin;
 using namespace OpenMM;
 using namespace std;
 using namespace Ort;
 
-OnnxForceImpl::OnnxForceImpl(const OnnxForce& owner) : CustomCPPForceImpl(owner), owner(owner), session(nullptr) {
+/**
+ * All sessions are created in a single, process wide environment.  It is intentionally never deleted,
+ * since sessions may outlive static destructors when the plugin is used from Python.  If global thread
+ * pools are requested, they belong to the environment and must be created along with it.
+ */
+static mutex environmentMutex;
+static Env* environment = nullptr;
+static bool environmentHasThreadPools = false;
+static string threadPoolSettings;
+
+static Env& getEnvironment() {
+    lock_guard<mutex> lock(environmentMutex);
+    if (environment == nullptr)
+        environment = new Env(ORT_LOGGING_LEVEL_WARNING, "OpenMMONNX");
+    return *environment;
+}
+
+static void createGlobalThreadPools(int intraOpThreads, int interOpThreads, const string& affinity, bool allowSpinning) {
+    // The pools can only be created once, so every force that uses them must request the same settings.
+
+    stringstream settings;
+    settings<<intraOpThreads<<":"<<interOpThreads<<":"<<affinity<<":"<<allowSpinning;
+    lock_guard<mutex> lock(environmentMutex);
+    if (environment != nullptr) {
+        if (!environmentHasThreadPools)
+            throw OpenMMException("GlobalThreadPool must be enabled for the first OnnxForce used in a process");
+        if (settings.str() != threadPoolSettings)
+            throw OpenMMException("Every OnnxForce with GlobalThreadPool enabled must use the same values of IntraOpThreads, InterOpThreads, IntraOpThreadAffinity, and AllowSpinning");
+        return;
+    }
+    ThreadingOptions threading;
+    threading.SetGlobalIntraOpNumThreads(intraOpThreads);
+    threading.SetGlobalInterOpNumThreads(interOpThreads);
+    threading.SetGlobalSpinControl(allowSpinning ? 1 : 0);
+    if (affinity.size() > 0)
+        ThrowOnError(GetApi().SetGlobalIntraOpThreadAffinity(threading, affinity.c_str()));
+    environment = new Env(threading, ORT_LOGGING_LEVEL_WARNING, "OpenMMONNX");
+    environmentHasThreadPools = true;
+    threadPoolSettings = settings.str();
+}
+
+static uint64_t computeHash(const void* data, size_t size) {
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static basic_string<ORTCHAR_T> toOrtPath(const string& path) {
+    return basic_string<ORTCHAR_T>(path.begin(), path.end());
+}
+
+static bool getBoolProperty(const OnnxForce& force, const string& name) {
+    const string& value = force.getProperties().at(name);
+    if (value == "true")
+        return true;
+    if (value == "false")
+        return false;
+    throw OpenMMException("Illegal value for "+name+": "+value);
+}
+
+static int getIntProperty(const OnnxForce& force, const string& name) {
+    const string& value = force.getProperties().at(name);
+    char* end;
+    long result = strtol(value.c_str(), &end, 10);
+    if (value.size() == 0 || *end != '\0' || result < 0)
+        throw OpenMMException("Illegal value for "+name+": "+value);
+    return (int) result;
+}
+
+static double getDoubleProperty(const OnnxForce& force, const string& name) {
+    const string& value = force.getProperties().at(name);
+    char* end;
+    double result = strtod(value.c_str(), &end);
+    if (value.size() == 0 || *end != '\0' || !(result >= 0))
+        throw OpenMMException("Illegal value for "+name+": "+value);
+    return result;
+}
+
+/**
+ * These are the properties createSessionOptions() reads.  Only they are included in the key for sharing
+ * sessions, so forces that differ only in other properties can still share one.
+ */
+static const char* sessionProperties[] = {"UseGraphs", "TensorRTEngineCachePath", "TensorRTTimingCachePath", "TensorRTPrecision",
+        "IntraOpThreads", "InterOpThreads", "AllowSpinning", "IntraOpThreadAffinity", "GlobalThreadPool", "GraphOptimizationLevel",
+        "ExecutionMode", "EnableMemoryPattern", "EnableCpuMemArena", "ProfilingFilePrefix"};
+
+static mutex sessionCacheMutex;
+static map<string, weak_ptr<Session> > sessionCache;
+static mutex batchGroupMutex;
+static map<string, weak_ptr<OnnxBatchGroup> > batchGroups;
+
+OnnxForceImpl::OnnxForceImpl(const OnnxForce& owner) : CustomCPPForceImpl(owner), owner(owner), binding(nullptr), neighborInputIndex(-1),
+        hasNeighborShifts(false), resultValid(false), energyValid(false), forcesRequested(true), energyRequested(true), clearForces(false), sharedSession(false), evaluationInterval(1), energyBinding(nullptr),
+        asyncPending(false), enableTiming(false), numCalls(0), numEvaluations(0), lastBatchSize(0) {
+    for (int i = 0; i < NumPhases; i++) {
+        totalTime[i] = 0;
+        lastTime[i] = 0;
+    }
 }
 
 OnnxForceImpl::~OnnxForceImpl() {
+    if (asyncPending)
+        asyncThread->waitForThreads();
 }
 
 void OnnxForceImpl::initialize(ContextImpl& context) {
@@ -50,32 +165,550 @@ void OnnxForceImpl::initialize(ContextImpl& context) {
 
     // Record which particles the force is applied to.
 
-    particleIndices = owner.getParticleIndices();
-    if (particleIndices.size() == 0) {
-        int numParticles = context.getSystem().getNumParticles();
-        for (int i = 0; i < numParticles; i++)
-            particleIndices.push_back(i);
-    }
+    loadParticleIndices(context.getSystem().getNumParticles());
+
+    // Converting positions and forces can optionally be split between several threads.
+
+    int conversionThreadCount = getIntProperty(owner, "ConversionThreads");
+    if (conversionThreadCount > 1)
+        conversionThreads.reset(new ThreadPool(conversionThreadCount));
+
+    // Asynchronous evaluation uses a dedicated thread.
 
-    // Select the execution provider and set options.
+    if (getBoolProperty(owner, "AsyncEvaluation"))
+        asyncThread.reset(new ThreadPool(1));
+    enableTiming = getBoolProperty(owner, "EnableTiming");
+    evaluationInterval = getIntProperty(owner, "EvaluationInterval");
+    if (evaluationInterval < 1)
+        throw OpenMMException("Illegal value for EvaluationInterval: "+owner.getProperties().at("EvaluationInterval"));
+
+    // Select the execution provider and set options.  DeviceIndex may list several devices, in which case
+    // the particles are divided into spatial domains that are evaluated on different devices.
 
     OnnxForce::ExecutionProvider provider = owner.getExecutionProvider();
-    string deviceIndex = owner.getProperties().at("DeviceIndex");
-    string enableGraph;
-    if (owner.getProperties().at("UseGraphs") == "true")
-        enableGraph = "1";
-    else if (owner.getProperties().at("UseGraphs") == "false")
-        enableGraph = "0";
+    vector<string> devices;
+    stringstream deviceList(owner.getProperties().at("DeviceIndex"));
+    string device;
+    while (getline(deviceList, device, ','))
+        devices.push_back(device);
+    if (devices.size() == 0)
+        throw OpenMMException("Illegal value for DeviceIndex: "+owner.getProperties().at("DeviceIndex"));
+    for (const string& d : devices) {
+        char* end;
+        long index = strtol(d.c_str(), &end, 10);
+        if (d.size() == 0 || *end != '\0' || index < 0)
+            throw OpenMMException("Illegal value for DeviceIndex: "+owner.getProperties().at("DeviceIndex"));
+    }
+    string enableGraph = (getBoolProperty(owner, "UseGraphs") ? "1" : "0");
+    int platformThreads = 0;
+    if (context.getPlatform().getName() == "CPU")
+        platformThreads = strtol(context.getPlatform().getPropertyValue(context.getOwner(), "Threads").c_str(), nullptr, 10);
+
+    // TensorRT can optionally build its engine for the exact shapes of the inputs, instead of for a range
+    // of shapes discovered at the first evaluation.
+
+    string profileShapes;
+    if (getBoolProperty(owner, "TensorRTFixedShapes")) {
+        if (devices.size() > 1)
+            throw OpenMMException("TensorRTFixedShapes cannot be used with multiple devices");
+        if (owner.getProperties().at("BatchGroup").size() > 0)
+            throw OpenMMException("TensorRTFixedShapes cannot be used with BatchGroup");
+        if (getDoubleProperty(owner, "NeighborCutoff") > 0)
+            throw OpenMMException("TensorRTFixedShapes cannot be used with NeighborCutoff");
+        stringstream shapes;
+        shapes<<"positions:"<<particleIndices.size()<<"x3";
+        if (owner.usesPeriodicBoundaryConditions())
+            shapes<<",box:3x3";
+        for (int i = 0; i < owner.getNumGlobalParameters(); i++)
+            shapes<<","<<owner.getGlobalParameterName(i)<<":1";
+        for (int i = 0; i < owner.getNumInputs(); i++) {
+            const vector<int>& shape = owner.getInput(i).getShape();
+            if (shape.size() == 0)
+                continue;
+            shapes<<","<<owner.getInput(i).getName()<<":";
+            for (int j = 0; j < shape.size(); j++)
+                shapes<<(j > 0 ? "x" : "")<<shape[j];
+        }
+        profileShapes = shapes.str();
+    }
+    vector<OnnxForce::ExecutionProvider> providers;
+    SessionOptions options = createSessionOptions(owner, devices[0], platformThreads, profileShapes, providers);
+
+    // Create the session and initialize data structures.  Contexts that use the same model with the same
+    // settings share a single session, so the model only needs to be loaded and optimized once.  CUDA and
+    // HIP graphs are recorded for specific buffers, so sessions that use them cannot be shared.
+
+    const vector<uint8_t>& model = owner.getModel();
+    stringstream settings;
+    settings<<provider<<":"<<devices[0]<<":"<<platformThreads<<":"<<profileShapes;
+    for (const char* name : sessionProperties)
+        settings<<":"<<name<<"="<<owner.getProperties().at(name);
+    stringstream key;
+    key<<hex<<computeHash(model.data(), model.size())<<":"<<model.size()<<":"<<settings.str();
+    const string& optimizedModelCachePath = owner.getProperties().at("OptimizedModelCachePath");
+    auto getOptimizedModelFile = [&] (const string& key, const vector<OnnxForce::ExecutionProvider>& sessionProviders) {
+        // Models containing nodes compiled by TensorRT cannot be saved, but TensorRT has its own engine cache.
+
+        if (optimizedModelCachePath.size() == 0 || find(sessionProviders.begin(), sessionProviders.end(), OnnxForce::TensorRT) != sessionProviders.end())
+            return string();
+
+        // The optimized model may contain nodes specific to the providers it was created for.  With the
+        // Default provider, those depend on what is available on this computer, so the filename must reflect
+        // the providers that were actually chosen.
+
+        stringstream fileKey;
+        fileKey<<key<<":providers=";
+        for (OnnxForce::ExecutionProvider p : sessionProviders)
+            fileKey<<p<<",";
+        stringstream filename;
+        filename<<optimizedModelCachePath<<"/"<<hex<<computeHash(fileKey.str().data(), fileKey.str().size())<<".onnx";
+        return filename.str();
+    };
+    string optimizedModelFile = getOptimizedModelFile(key.str(), providers);
+    SessionOptions baseOptions = options.Clone();
+
+    // If the model was loaded from a file that has not changed since then, ONNX Runtime can load it directly
+    // from the file.  That avoids an extra copy of the model in memory, and lets it find external data files
+    // stored next to the model.
+
+    string modelFile = owner.modelFile;
+    long long fileSize, fileTime;
+    if (modelFile.size() > 0 && (!getFileInfo(modelFile, fileSize, fileTime) || (size_t) fileSize != model.size() || fileTime != owner.modelFileTime))
+        modelFile = "";
+    if (enableGraph == "1")
+        session = createSession(model, modelFile, options, optimizedModelFile);
     else
-        throw OpenMMException("Illegal value for UseGraphs: "+owner.getProperties().at("UseGraphs"));
+        session = getSession(model, modelFile, key.str(), options, optimizedModelFile);
+    sharedSession = (session.use_count() > 1);
+
+    // Create the input tensors.  Each one uses whatever element type the model declares for it, so models
+    // can work in single, double, or half precision.
+
+    int numParticles = particleIndices.size();
+    int numParameters = owner.getNumGlobalParameters();
+    auto memoryInfo = MemoryInfo::CreateCpu(OrtDeviceAllocator, OrtMemTypeCPU);
+    positionData.resize(getInputType("positions", true), 3*numParticles);
+    inputTensors.emplace_back(positionData.createTensor(memoryInfo, {numParticles, 3}));
+    inputNames.push_back("positions");
+    if (owner.usesPeriodicBoundaryConditions()) {
+        boxData.resize(getInputType("box", true), 9);
+        inputTensors.emplace_back(boxData.createTensor(memoryInfo, {3, 3}));
+        inputNames.push_back("box");
+    }
+    paramData.resize(numParameters);
+    lastPositions.resize(numParticles);
+
+    // The Context stores parameters in a map that never changes structure, so we can look up where each
+    // one is stored once here, instead of searching by name on every step.  The last values start out as
+    // NaN, so every parameter is copied into its tensor on the first step.
+
+    lastParams.resize(numParameters, numeric_limits<double>::quiet_NaN());
+    const map<string, double>& contextParams = context.getParameters();
+    for (int i = 0; i < numParameters; i++) {
+        const string& name = owner.getGlobalParameterName(i);
+        auto param = contextParams.find(name);
+        if (param == contextParams.end())
+            throw OpenMMException("The Context does not contain a parameter called '"+name+"'");
+        paramValues.push_back(&param->second);
+        paramData[i].resize(getInputType(name, true), 1);
+        inputTensors.emplace_back(paramData[i].createTensor(memoryInfo, {1}));
+        inputNames.push_back(name.c_str());
+    }
+
+    // If requested, the neighbor list is computed here and passed to the model.  Its size changes whenever
+    // it is rebuilt, so it cannot be used with graphs or batching, which require fixed shapes.
+
+    double neighborCutoff = getDoubleProperty(owner, "NeighborCutoff");
+    if (neighborCutoff > 0) {
+        if (enableGraph == "1")
+            throw OpenMMException("NeighborCutoff cannot be used with UseGraphs");
+        if (owner.getProperties().at("BatchGroup").size() > 0)
+            throw OpenMMException("NeighborCutoff cannot be used with BatchGroup");
+        neighborList.reset(new OnnxNeighborList(neighborCutoff, getDoubleProperty(owner, "NeighborSkin"), owner.usesPeriodicBoundaryConditions()));
+        neighborInputIndex = inputTensors.size();
+        neighborData.resize(getInputType("neighbors", false), 0);
+        inputTensors.emplace_back(neighborData.createTensor(memoryInfo, {2, 0}));
+        inputNames.push_back("neighbors");
+        hasNeighborShifts = (findInput("neighborShifts") != -1);
+        if (hasNeighborShifts) {
+            shiftData.resize(getInputType("neighborShifts", true), 0);
+            inputTensors.emplace_back(shiftData.createTensor(memoryInfo, {0, 3}));
+            inputNames.push_back("neighborShifts");
+        }
+    }
+    numDynamicInputs = inputTensors.size();
+    inputChanged.resize(numDynamicInputs, true);
+    energyInputChanged.resize(numDynamicInputs, true);
+
+    // Process extra inputs.  They are converted to the element types the model expects.
+
+    extraInputData.resize(owner.getNumInputs());
+    for (int i = 0; i < owner.getNumInputs(); i++) {
+        const OnnxForce::Input& input = owner.getInput(i);
+        const OnnxForce::IntegerInput* integerInput = dynamic_cast<const OnnxForce::IntegerInput*>(&input);
+        const OnnxForce::FloatInput* floatInput = dynamic_cast<const OnnxForce::FloatInput*>(&input);
+        ONNXTensorElementDataType type = getInputType(input.getName(), floatInput != nullptr);
+        if (integerInput != nullptr) {
+            validateInput(input.getName(), input.getShape(), integerInput->getValues().size());
+            extraInputData[i].resize(type, integerInput->getValues().size());
+            extraInputData[i].setValues(integerInput->getValues().data(), integerInput->getValues().size());
+        }
+        if (floatInput != nullptr) {
+            validateInput(input.getName(), input.getShape(), floatInput->getValues().size());
+            extraInputData[i].resize(type, floatInput->getValues().size());
+            extraInputData[i].setValues(floatInput->getValues().data(), floatInput->getValues().size());
+        }
+        vector<int64_t> shape(input.getShape().begin(), input.getShape().end());
+        inputTensors.emplace_back(extraInputData[i].createTensor(memoryInfo, shape));
+        inputNames.push_back(input.getName().c_str());
+    }
+
+    // Preallocate the outputs so ONNX Runtime can write directly into them on every step.
+
+    vector<int64_t> energyShape = getOutputShape(*session, "energy");
+    energyData.resize(getOutputType(*session, "energy"), 1);
+    forceData.resize(getOutputType(*session, "forces"), 3*numParticles);
+    outputTensors.emplace_back(energyData.createTensor(memoryInfo, energyShape));
+    outputTensors.emplace_back(forceData.createTensor(memoryInfo, {numParticles, 3}));
+
+    // If derivatives with respect to parameters were requested, the model returns them as a third output.
+
+    int numDerivatives = owner.getNumEnergyParameterDerivatives();
+    if (numDerivatives > 0) {
+        if (devices.size() > 1)
+            throw OpenMMException("Energy parameter derivatives cannot be used with multiple devices");
+        if (owner.getProperties().at("BatchGroup").size() > 0)
+            throw OpenMMException("Energy parameter derivatives cannot be used with BatchGroup");
+        if (owner.getNumAdditionalModels() > 0)
+            throw OpenMMException("Energy parameter derivatives cannot be used with additional models");
+        for (int i = 0; i < numDerivatives; i++) {
+            const string& name = owner.getEnergyParameterDerivativeName(i);
+            bool found = false;
+            for (int j = 0; j < numParameters; j++)
+                if (name == owner.getGlobalParameterName(j))
+                    found = true;
+            if (!found)
+                throw OpenMMException("addEnergyParameterDerivative: Unknown global parameter '"+name+"'");
+        }
+        derivativeData.resize(getOutputType(*session, "energyParameterDerivatives"), numDerivatives);
+        outputTensors.emplace_back(derivativeData.createTensor(memoryInfo, {numDerivatives}));
+        parameterDerivatives.resize(numDerivatives, 0.0);
+    }
+
+    // If several devices were specified, divide the particles into domains that are evaluated on different
+    // devices.  The inputs are passed to the model in a different way, so skip binding them.
+
+    if (devices.size() > 1) {
+        if (enableGraph == "1")
+            throw OpenMMException("Multiple devices cannot be used with UseGraphs");
+        if (owner.getProperties().at("BatchGroup").size() > 0)
+            throw OpenMMException("Multiple devices cannot be used with BatchGroup");
+        if (neighborList)
+            throw OpenMMException("Multiple devices cannot be used with NeighborCutoff");
+        if (owner.getNumAdditionalModels() > 0)
+            throw OpenMMException("Multiple devices cannot be used with additional models");
+        double haloWidth = getDoubleProperty(owner, "DomainHaloWidth");
+        if (haloWidth == 0)
+            throw OpenMMException("DomainHaloWidth must be set when DeviceIndex specifies multiple devices");
+        vector<shared_ptr<Session> > sessions = {session};
+        for (int i = 1; i < devices.size(); i++) {
+            vector<OnnxForce::ExecutionProvider> deviceProviders;
+            SessionOptions deviceOptions = createSessionOptions(owner, devices[i], platformThreads, "", deviceProviders);
+            string deviceKey = key.str()+":device="+devices[i];
+            sessions.push_back(getSession(model, modelFile, deviceKey, deviceOptions, getOptimizedModelFile(deviceKey, deviceProviders)));
+        }
+        vector<OnnxDomainDecomposition::Input> domainInputs;
+        for (int i = 0; i < inputTensors.size(); i++) {
+            vector<int64_t> shape = inputTensors[i].GetTensorTypeAndShapeInfo().GetShape();
+            OnnxTensorData* data;
+            if (i == 0)
+                data = &positionData;
+            else if (owner.usesPeriodicBoundaryConditions() && i == 1)
+                data = &boxData;
+            else if (i < numDynamicInputs)
+                data = &paramData[i-(owner.usesPeriodicBoundaryConditions() ? 2 : 1)];
+            else
+                data = &extraInputData[i-numDynamicInputs];
+            bool perParticle = (i == 0 || (i >= numDynamicInputs && shape.size() > 0 && shape[0] == numParticles));
+            domainInputs.push_back({inputNames[i], data, shape, perParticle});
+        }
+        ONNXTensorElementDataType maskType = getInputType("ownedParticles", false);
+        domains.reset(new OnnxDomainDecomposition(sessions, domainInputs, numParticles, haloWidth,
+                owner.usesPeriodicBoundaryConditions(), maskType, energyShape));
+        if (getBoolProperty(owner, "Warmup"))
+            warmup(context);
+        return;
+    }
+
+    // If this force is part of a batch group, find the group and skip binding the inputs, since
+    // they are passed to the model in a different way.
+
+    const string& batchGroupName = owner.getProperties().at("BatchGroup");
+    if (batchGroupName.size() > 0) {
+        int batchSize = getIntProperty(owner, "BatchSize");
+        int batchTimeout = getIntProperty(owner, "BatchTimeout");
+        if (batchSize < 1)
+            throw OpenMMException("Illegal value for BatchSize: "+owner.getProperties().at("BatchSize"));
+        if (owner.getNumAdditionalModels() > 0)
+            throw OpenMMException("BatchGroup cannot be used with additional models");
+        vector<string> parameterNames;
+        for (int i = 0; i < numParameters; i++)
+            parameterNames.push_back(owner.getGlobalParameterName(i));
+
+        // Extra inputs are not batched, so forces can only be evaluated together if they have the same values
+        // for them.  Include a hash of the values in the key, so forces that differ get separate groups.
+
+        stringstream groupKey;
+        groupKey<<batchGroupName<<":"<<key.str()<<":"<<numParticles<<":"<<batchSize<<":"<<batchTimeout;
+        for (int i = 0; i < extraInputData.size(); i++)
+            groupKey<<":"<<owner.getInput(i).getName()<<"="<<hex<<computeHash(extraInputData[i].getData(), extraInputData[i].getBytes());
+        {
+            lock_guard<mutex> lock(batchGroupMutex);
+            batchGroup = batchGroups[groupKey.str()].lock();
+            if (!batchGroup) {
+                for (auto iter = batchGroups.begin(); iter != batchGroups.end(); ) {
+                    if (iter->second.expired())
+                        iter = batchGroups.erase(iter);
+                    else
+                        ++iter;
+                }
+                batchGroup = make_shared<OnnxBatchGroup>(session, numParticles, owner.usesPeriodicBoundaryConditions(), parameterNames, batchSize, batchTimeout);
+                batchGroups[groupKey.str()] = batchGroup;
+            }
+        }
+
+        // The warmup evaluation goes through the group like any other, so it may be combined with those of
+        // other Contexts that are being created at the same time.  The lock must not be held while waiting.
+
+        if (getBoolProperty(owner, "Warmup"))
+            warmup(context);
+        return;
+    }
+
+    // Bind the inputs and outputs.  The extra inputs never change, so they are bound once here.  Binding
+    // copies them to whatever device the model runs on, so they do not need to be transferred again on
+    // every step.  Positions, box vectors, and parameters are rebound in computeForce().
+
+    binding = IoBinding(*session);
+    for (int i = numDynamicInputs; i < inputTensors.size(); i++)
+        binding.BindInput(inputNames[i], inputTensors[i]);
+    binding.BindOutput("energy", outputTensors[0]);
+    binding.BindOutput("forces", outputTensors[1]);
+    if (numDerivatives > 0)
+        binding.BindOutput("energyParameterDerivatives", outputTensors[2]);
+
+    // If there is an energy-only model, create a session for it too.  It uses the same input and output
+    // buffers as the main model, so it must declare the same types for them.
+
+    const vector<uint8_t>& energyModel = owner.getEnergyOnlyModel();
+    if (energyModel.size() > 0) {
+        stringstream energyKey;
+        energyKey<<hex<<computeHash(energyModel.data(), energyModel.size())<<":"<<energyModel.size()<<":"<<settings.str();
+        string energyOptimizedModelFile = getOptimizedModelFile(energyKey.str(), providers);
+        SessionOptions energyOptions = baseOptions.Clone();
+        if (enableGraph == "1")
+            energySession = createSession(energyModel, "", energyOptions, energyOptimizedModelFile);
+        else
+            energySession = getSession(energyModel, "", energyKey.str(), energyOptions, energyOptimizedModelFile);
+        AllocatorWithDefaultOptions allocator;
+        map<string, ONNXTensorElementDataType> energyInputTypes;
+        for (int i = 0; i < energySession->GetInputCount(); i++)
+            energyInputTypes[energySession->GetInputNameAllocated(i, allocator).get()] = energySession->GetInputTypeInfo(i).GetTensorTypeAndShapeInfo().GetElementType();
+        if (energyInputTypes.size() != inputNames.size())
+            throw OpenMMException("The energy-only model must have the same inputs as the main model");
+        for (int i = 0; i < inputNames.size(); i++) {
+            auto type = energyInputTypes.find(inputNames[i]);
+            if (type == energyInputTypes.end())
+                throw OpenMMException(string("The energy-only model does not have an input called '")+inputNames[i]+"'");
+            if (type->second != inputTensors[i].GetTensorTypeAndShapeInfo().GetElementType())
+                throw OpenMMException(string("The energy-only model has a different type for input '")+inputNames[i]+"' than the main model");
+        }
+        bool hasEnergy = false;
+        for (int i = 0; i < energySession->GetOutputCount(); i++)
+            if (string("energy") == energySession->GetOutputNameAllocated(i, allocator).get()) {
+                hasEnergy = true;
+                if (energySession->GetOutputTypeInfo(i).GetTensorTypeAndShapeInfo().GetElementType() != energyData.getType())
+                    throw OpenMMException("The energy-only model has a different type for output 'energy' than the main model");
+            }
+        if (!hasEnergy)
+            throw OpenMMException("The energy-only model does not have an output called 'energy'");
+        energyBinding = IoBinding(*energySession);
+        for (int i = numDynamicInputs; i < inputTensors.size(); i++)
+            energyBinding.BindInput(inputNames[i], inputTensors[i]);
+        energyBinding.BindOutput("energy", outputTensors[0]);
+    }
+
+    // Create sessions for any additional models.  They use the same input tensors as the main model, so
+    // positions only need to be gathered once, but each one has its own outputs.  Their forces are added
+    // to those of the main model when they are copied out.
+
+    additionalModels.resize(owner.getNumAdditionalModels());
+    for (int i = 0; i < additionalModels.size(); i++) {
+        AdditionalModel& additional = additionalModels[i];
+        const vector<uint8_t>& additionalModel = owner.getAdditionalModel(i);
+        stringstream additionalKey;
+        additionalKey<<hex<<computeHash(additionalModel.data(), additionalModel.size())<<":"<<additionalModel.size()<<":"<<settings.str();
+        string additionalOptimizedModelFile = getOptimizedModelFile(additionalKey.str(), providers);
+        SessionOptions additionalOptions = baseOptions.Clone();
+        if (enableGraph == "1")
+            additional.session = createSession(additionalModel, "", additionalOptions, additionalOptimizedModelFile);
+        else
+            additional.session = getSession(additionalModel, "", additionalKey.str(), additionalOptions, additionalOptimizedModelFile);
+        AllocatorWithDefaultOptions allocator;
+        additional.usesInput.resize(inputNames.size(), false);
+        additional.inputChanged.resize(numDynamicInputs, true);
+        for (int j = 0; j < additional.session->GetInputCount(); j++) {
+            string name = additional.session->GetInputNameAllocated(j, allocator).get();
+            int index = -1;
+            for (int k = 0; k < inputNames.size(); k++)
+                if (name == inputNames[k])
+                    index = k;
+            if (index == -1)
+                throw OpenMMException("Additional model "+to_string(i)+" has an input called '"+name+"', which is not passed to the main model");
+            if (additional.session->GetInputTypeInfo(j).GetTensorTypeAndShapeInfo().GetElementType() != inputTensors[index].GetTensorTypeAndShapeInfo().GetElementType())
+                throw OpenMMException("Additional model "+to_string(i)+" has a different type for input '"+name+"' than the main model");
+            additional.usesInput[index] = true;
+        }
+        additional.energyData.resize(getOutputType(*additional.session, "energy"), 1);
+        additional.forceData.resize(getOutputType(*additional.session, "forces"), 3*numParticles);
+        additional.outputTensors.emplace_back(additional.energyData.createTensor(memoryInfo, getOutputShape(*additional.session, "energy")));
+        additional.outputTensors.emplace_back(additional.forceData.createTensor(memoryInfo, {numParticles, 3}));
+        additional.binding = IoBinding(*additional.session);
+        for (int j = numDynamicInputs; j < inputTensors.size(); j++)
+            if (additional.usesInput[j])
+                additional.binding.BindInput(inputNames[j], inputTensors[j]);
+        additional.binding.BindOutput("energy", additional.outputTensors[0]);
+        additional.binding.BindOutput("forces", additional.outputTensors[1]);
+    }
+    if (getBoolProperty(owner, "Warmup"))
+        warmup(context);
+}
+
+void OnnxForceImpl::warmup(ContextImpl& context) {
+    // Evaluate the model once with inputs of the real shapes, so kernel selection, graph capture, and
+    // building TensorRT engines all happen now instead of on the first step.  The positions have not been
+    // set yet, so place the particles on a grid.  That avoids overlapping particles, which could cause
+    // some models to produce NaNs.  The results are discarded, and this is not included in the timing
+    // statistics.
+
+    vector<Vec3> positions(context.getSystem().getNumParticles());
+    int numParticles = particleIndices.size();
+    int gridSize = (int) ceil(cbrt((double) numParticles));
+    for (int i = 0; i < numParticles; i++)
+        positions[particleIndices[i]] = Vec3(i%gridSize, (i/gridSize)%gridSize, i/(gridSize*gridSize))*0.3;
+    bool timing = enableTiming;
+    enableTiming = false;
+    setInputs(context, positions);
+    evaluateModel(true);
+    if (energySession)
+        evaluateModel(false);
+    enableTiming = timing;
+    resultValid = false;
+    energyValid = false;
+}
+
+double OnnxForceImpl::calcForcesAndEnergy(ContextImpl& context, bool includeForces, bool includeEnergy, int groups) {
+    // Record whether forces are needed, since computeForce() is not told.
+
+    forcesRequested = includeForces;
+    energyRequested = includeEnergy;
+    return CustomCPPForceImpl::calcForcesAndEnergy(context, includeForces, includeEnergy, groups);
+}
+
+SessionOptions OnnxForceImpl::createSessionOptions(const OnnxForce& owner, const string& deviceIndex, int platformThreads,
+            const string& profileShapes, vector<OnnxForce::ExecutionProvider>& providers) {
+    OnnxForce::ExecutionProvider provider = owner.getExecutionProvider();
+    string enableGraph = (getBoolProperty(owner, "UseGraphs") ? "1" : "0");
+    const string& engineCachePath = owner.getProperties().at("TensorRTEngineCachePath");
+    const string& timingCachePath = owner.getProperties().at("TensorRTTimingCachePath");
+    const string& precision = owner.getProperties().at("TensorRTPrecision");
+    if (precision != "fp32" && precision != "fp16" && precision != "int8")
+        throw OpenMMException("Illegal value for TensorRTPrecision: "+precision);
     SessionOptions options;
+
+    // When OpenMM's CPU platform is computing the other forces, ONNX Runtime should use the same number of
+    // threads by default, and its threads should not keep spinning after they finish, since that takes cores
+    // away from the platform's threads.
+
+    int intraOpThreads = getIntProperty(owner, "IntraOpThreads");
+    int interOpThreads = getIntProperty(owner, "InterOpThreads");
+    if (intraOpThreads == 0)
+        intraOpThreads = platformThreads;
+    const string& spinning = owner.getProperties().at("AllowSpinning");
+    if (spinning != "auto" && spinning != "true" && spinning != "false")
+        throw OpenMMException("Illegal value for AllowSpinning: "+spinning);
+    bool allowSpinning = (spinning == "auto" ? platformThreads == 0 : spinning == "true");
+    const string& affinity = owner.getProperties().at("IntraOpThreadAffinity");
+    if (getBoolProperty(owner, "GlobalThreadPool")) {
+        createGlobalThreadPools(intraOpThreads, interOpThreads, affinity, allowSpinning);
+        options.DisablePerSessionThreads();
+    }
+    else {
+        options.SetIntraOpNumThreads(intraOpThreads);
+        options.SetInterOpNumThreads(interOpThreads);
+        if (affinity.size() > 0)
+            options.AddConfigEntry("session.intra_op_thread_affinities", affinity.c_str());
+        options.AddConfigEntry("session.intra_op.allow_spinning", allowSpinning ? "1" : "0");
+        options.AddConfigEntry("session.inter_op.allow_spinning", allowSpinning ? "1" : "0");
+    }
+    const string& optimizationLevel = owner.getProperties().at("GraphOptimizationLevel");
+    if (optimizationLevel == "all")
+        options.SetGraphOptimizationLevel(ORT_ENABLE_ALL);
+    else if (optimizationLevel == "extended")
+        options.SetGraphOptimizationLevel(ORT_ENABLE_EXTENDED);
+    else if (optimizationLevel == "basic")
+        options.SetGraphOptimizationLevel(ORT_ENABLE_BASIC);
+    else if (optimizationLevel == "disabled")
+        options.SetGraphOptimizationLevel(ORT_DISABLE_ALL);
+    else
+        throw OpenMMException("Illegal value for GraphOptimizationLevel: "+optimizationLevel);
+    const string& executionMode = owner.getProperties().at("ExecutionMode");
+    if (executionMode == "sequential")
+        options.SetExecutionMode(ORT_SEQUENTIAL);
+    else if (executionMode == "parallel")
+        options.SetExecutionMode(ORT_PARALLEL);
+    else
+        throw OpenMMException("Illegal value for ExecutionMode: "+executionMode);
+    if (!getBoolProperty(owner, "EnableMemoryPattern"))
+        options.DisableMemPattern();
+    if (!getBoolProperty(owner, "EnableCpuMemArena"))
+        options.DisableCpuMemArena();
+    const string& profilingPrefix = owner.getProperties().at("ProfilingFilePrefix");
+    if (profilingPrefix.size() > 0)
+        options.EnableProfiling(toOrtPath(profilingPrefix).c_str());
     if (provider == OnnxForce::TensorRT || provider == OnnxForce::Default) {
         OrtTensorRTProviderOptionsV2* rtOptions = nullptr;
         if (GetApi().CreateTensorRTProviderOptions(&rtOptions) == nullptr) {
             vector<const char*> keys{"device_id", "trt_cuda_graph_enable"};
             vector<const char*> values{deviceIndex.c_str(), enableGraph.c_str()};
-            ThrowOnError(GetApi().UpdateTensorRTProviderOptions(rtOptions, keys.data(), values.data(), 2));
+            if (engineCachePath.size() > 0) {
+                keys.push_back("trt_engine_cache_enable");
+                values.push_back("1");
+                keys.push_back("trt_engine_cache_path");
+                values.push_back(engineCachePath.c_str());
+            }
+            if (timingCachePath.size() > 0) {
+                keys.push_back("trt_timing_cache_enable");
+                values.push_back("1");
+                keys.push_back("trt_timing_cache_path");
+                values.push_back(timingCachePath.c_str());
+            }
+            if (precision == "fp16" || precision == "int8") {
+                keys.push_back("trt_fp16_enable");
+                values.push_back("1");
+            }
+            if (precision == "int8") {
+                keys.push_back("trt_int8_enable");
+                values.push_back("1");
+            }
+            if (profileShapes.size() > 0)
+                for (const char* key : {"trt_profile_min_shapes", "trt_profile_opt_shapes", "trt_profile_max_shapes"}) {
+                    keys.push_back(key);
+                    values.push_back(profileShapes.c_str());
+                }
+            ThrowOnError(GetApi().UpdateTensorRTProviderOptions(rtOptions, keys.data(), values.data(), keys.size()));
             options.AppendExecutionProvider_TensorRT_V2(*rtOptions);
+            providers.push_back(OnnxForce::TensorRT);
         }
         else if (provider == OnnxForce::TensorRT)
             throw OpenMMException("TensorRT execution provider is not available");
@@ -87,6 +720,7 @@ void OnnxForceImpl::initialize(ContextImpl& context) {
             vector<const char*> values{deviceIndex.c_str(), "0", enableGraph.c_str()};
             ThrowOnError(GetApi().UpdateCUDAProviderOptions(cudaOptions, keys.data(), values.data(), 3));
             options.AppendExecutionProvider_CUDA_V2(*cudaOptions);
+            providers.push_back(OnnxForce::CUDA);
         }
         else if (provider == OnnxForce::CUDA)
             throw OpenMMException("CUDA execution provider is not available");
@@ -98,63 +732,78 @@ void OnnxForceImpl::initialize(ContextImpl& context) {
             vector<const char*> values{deviceIndex.c_str(), enableGraph.c_str()};
             ThrowOnError(GetApi().UpdateROCMProviderOptions(rocmOptions, keys.data(), values.data(), 2));
             options.AppendExecutionProvider_ROCM(*rocmOptions);
+            providers.push_back(OnnxForce::ROCm);
         }
         else if (provider == OnnxForce::ROCm)
             throw OpenMMException("ROCm execution provider is not available");
     }
 
-    // Create the session and initialize data structures.
+    // ONNX Runtime runs anything the other providers cannot handle on the CPU.
 
-    const vector<uint8_t>& model = owner.getModel();
-    session = Session(env, model.data(), model.size(), options);
-    positionVec.resize(3*particleIndices.size());
-    paramVec.resize(owner.getNumGlobalParameters());
-    auto memoryInfo = MemoryInfo::CreateCpu(OrtDeviceAllocator, OrtMemTypeCPU);
-    int64_t positionsShape[] = {static_cast<int64_t>(particleIndices.size()), 3};
-    int64_t boxShape[] = {3, 3};
-    int64_t paramShape[] = {1};
-    int numInputs = 1+owner.getNumGlobalParameters();
-    if (owner.usesPeriodicBoundaryConditions())
-        numInputs++;
-    inputTensors.emplace_back(Value::CreateTensor<float>(memoryInfo, positionVec.data(), positionVec.size(), positionsShape, 2));
-    inputNames.push_back("positions");
-    if (owner.usesPeriodicBoundaryConditions()) {
-        inputTensors.emplace_back(Value::CreateTensor<float>(memoryInfo, boxVectors, 9, boxShape, 2));
-        inputNames.push_back("box");
+    providers.push_back(OnnxForce::CPU);
+    return options;
+}
+
+shared_ptr<Session> OnnxForceImpl::createSession(const vector<uint8_t>& model, const string& modelFile, SessionOptions& options,
+            const string& optimizedModelFile) {
+    if (optimizedModelFile.size() == 0) {
+        if (modelFile.size() > 0)
+            return make_shared<Session>(getEnvironment(), toOrtPath(modelFile).c_str(), options);
+        return make_shared<Session>(getEnvironment(), model.data(), model.size(), options);
     }
-    for (int i = 0; i < paramVec.size(); i++) {
-        inputTensors.emplace_back(Value::CreateTensor<float>(memoryInfo, &paramVec[i], 1, paramShape, 1));
-        inputNames.push_back(owner.getGlobalParameterName(i).c_str());
+    if (ifstream(optimizedModelFile).good()) {
+        // The model was optimized in an earlier run, so load it without optimizing it again.
+
+        options.SetGraphOptimizationLevel(ORT_DISABLE_ALL);
+        return make_shared<Session>(getEnvironment(), toOrtPath(optimizedModelFile).c_str(), options);
     }
 
-    // Process extra inputs.
+    // Have ONNX Runtime save the optimized model to a temporary file, then move it into place.  This
+    // ensures other processes never see a partially written file.
 
-    for (int i = 0; i < owner.getNumInputs(); i++) {
-        const OnnxForce::IntegerInput* integerInput = dynamic_cast<const OnnxForce::IntegerInput*>(&owner.getInput(i));
-        if (integerInput != nullptr) {
-            validateInput(integerInput->getName(), integerInput->getShape(), integerInput->getValues().size());
-            integerInputs.push_back(OnnxForce::IntegerInput(integerInput->getName(), integerInput->getValues(), integerInput->getShape()));
-        }
-        const OnnxForce::FloatInput* floatInput = dynamic_cast<const OnnxForce::FloatInput*>(&owner.getInput(i));
-        if (floatInput != nullptr) {
-            validateInput(floatInput->getName(), floatInput->getShape(), floatInput->getValues().size());
-            floatInputs.push_back(OnnxForce::FloatInput(floatInput->getName(), floatInput->getValues(), floatInput->getShape()));
+    stringstream tempFile;
+    tempFile<<optimizedModelFile<<".tmp"<<random_device()();
+    options.SetOptimizedModelFilePath(toOrtPath(tempFile.str()).c_str());
+    shared_ptr<Session> result;
+    if (modelFile.size() > 0)
+        result = make_shared<Session>(getEnvironment(), toOrtPath(modelFile).c_str(), options);
+    else
+        result = make_shared<Session>(getEnvironment(), model.data(), model.size(), options);
+    if (rename(tempFile.str().c_str(), optimizedModelFile.c_str()) != 0)
+        remove(tempFile.str().c_str());
+    return result;
+}
+
+shared_ptr<Session> OnnxForceImpl::getSession(const vector<uint8_t>& model, const string& modelFile, const string& key,
+            SessionOptions& options, const string& optimizedModelFile) {
+    lock_guard<mutex> lock(sessionCacheMutex);
+    shared_ptr<Session> result = sessionCache[key].lock();
+    if (!result) {
+        for (auto iter = sessionCache.begin(); iter != sessionCache.end(); ) {
+            if (iter->second.expired())
+                iter = sessionCache.erase(iter);
+            else
+                ++iter;
         }
+        result = createSession(model, modelFile, options, optimizedModelFile);
+        sessionCache[key] = result;
     }
-    for (OnnxForce::IntegerInput& input : integerInputs) {
-        vector<int64_t> shape;
-        for (int i : input.getShape())
-            shape.push_back(i);
-        inputTensors.emplace_back(Value::CreateTensor<int>(memoryInfo, input.getValues().data(), input.getValues().size(), shape.data(), shape.size()));
-        inputNames.push_back(input.getName().c_str());
-    }
-    for (OnnxForce::FloatInput& input : floatInputs) {
-        vector<int64_t> shape;
-        for (int i : input.getShape())
-            shape.push_back(i);
-        inputTensors.emplace_back(Value::CreateTensor<float>(memoryInfo, input.getValues().data(), input.getValues().size(), shape.data(), shape.size()));
-        inputNames.push_back(input.getName().c_str());
-    }
+    return result;
+}
+
+bool OnnxForceImpl::getFileInfo(const string& file, long long& size, long long& modificationTime) {
+    struct stat info;
+    if (stat(file.c_str(), &info) != 0)
+        return false;
+    size = info.st_size;
+#if defined(__APPLE__)
+    modificationTime = info.st_mtimespec.tv_sec*1000000000LL+info.st_mtimespec.tv_nsec;
+#elif defined(_WIN32)
+    modificationTime = info.st_mtime*1000000000LL;
+#else
+    modificationTime = info.st_mtim.tv_sec*1000000000LL+info.st_mtim.tv_nsec;
+#endif
+    return true;
 }
 
 void OnnxForceImpl::validateInput(const string& name, const vector<int>& shape, int size) {
@@ -168,6 +817,56 @@ void OnnxForceImpl::validateInput(const string& name, const vector<int>& shape,
     }
 }
 
+int OnnxForceImpl::findInput(const string& name) {
+    AllocatorWithDefaultOptions allocator;
+    for (int i = 0; i < session->GetInputCount(); i++)
+        if (name == session->GetInputNameAllocated(i, allocator).get())
+            return i;
+    return -1;
+}
+
+ONNXTensorElementDataType OnnxForceImpl::getInputType(const string& name, bool floatingPoint) {
+    int index = findInput(name);
+    if (index == -1)
+        throw OpenMMException("The model does not have an input called '"+name+"'");
+    ONNXTensorElementDataType type = session->GetInputTypeInfo(index).GetTensorTypeAndShapeInfo().GetElementType();
+    bool isInteger = (type == ONNX_TENSOR_ELEMENT_DATA_TYPE_INT32 || type == ONNX_TENSOR_ELEMENT_DATA_TYPE_INT64);
+    if (floatingPoint ? !OnnxTensorData::isFloatingPoint(type) : !isInteger) {
+        string expected = (floatingPoint ? "a floating point type" : "int32 or int64");
+        throw OpenMMException("Unsupported type for input '"+name+"': "+OnnxTensorData::getTypeName(type)+".  Expected "+expected+".");
+    }
+    return type;
+}
+
+ONNXTensorElementDataType OnnxForceImpl::getOutputType(Session& model, const string& name) {
+    AllocatorWithDefaultOptions allocator;
+    for (int i = 0; i < model.GetOutputCount(); i++) {
+        if (name == model.GetOutputNameAllocated(i, allocator).get()) {
+            ONNXTensorElementDataType type = model.GetOutputTypeInfo(i).GetTensorTypeAndShapeInfo().GetElementType();
+            if (!OnnxTensorData::isFloatingPoint(type))
+                throw OpenMMException("Unsupported type for output '"+name+"': "+OnnxTensorData::getTypeName(type)+".  Expected a floating point type.");
+            return type;
+        }
+    }
+    throw OpenMMException("The model does not have an output called '"+name+"'");
+}
+
+vector<int64_t> OnnxForceImpl::getOutputShape(Session& model, const string& name) {
+    AllocatorWithDefaultOptions allocator;
+    for (int i = 0; i < model.GetOutputCount(); i++) {
+        if (name == model.GetOutputNameAllocated(i, allocator).get()) {
+            // Any dynamic dimensions of a scalar output must have size 1.
+
+            vector<int64_t> shape = model.GetOutputTypeInfo(i).GetTensorTypeAndShapeInfo().GetShape();
+            for (int64_t& dim : shape)
+                if (dim < 0)
+                    dim = 1;
+            return shape;
+        }
+    }
+    throw OpenMMException("The model does not have an output called '"+name+"'");
+}
+
 map<string, double> OnnxForceImpl::getDefaultParameters() {
     map<string, double> parameters;
     for (int i = 0; i < owner.getNumGlobalParameters(); i++)
@@ -175,33 +874,411 @@ map<string, double> OnnxForceImpl::getDefaultParameters() {
     return parameters;
 }
 
-double OnnxForceImpl::computeForce(ContextImpl& context, const vector<Vec3>& positions, vector<Vec3>& forces) {
-    // Pass the current state to ONNX Runtime.
+void OnnxForceImpl::updateContextState(ContextImpl& context, bool& forcesInvalid) {
+    if (!asyncThread)
+        return;
+    if (context.getStepCount()%evaluationInterval != 0)
+        return;
+
+    // This is called at the start of every time step before forces are computed.  Start evaluating the
+    // model in the background, so it can run in parallel with the forces computed before this one.
+
+    waitForAsyncEvaluation();
+    context.getPositions(asyncPositions);
+    if (resultValid && inputsMatch(context, asyncPositions))
+        return;
+    setInputs(context, asyncPositions);
+    resultValid = false;
+    energyValid = false;
+    asyncError = nullptr;
+    asyncPending = true;
+    asyncThread->execute([&] (ThreadPool& pool, int threadIndex) {
+        try {
+            evaluateModel(true);
+        }
+        catch (...) {
+            asyncError = current_exception();
+        }
+    });
+}
+
+void OnnxForceImpl::waitForAsyncEvaluation() {
+    if (asyncPending) {
+        asyncThread->waitForThreads();
+        asyncPending = false;
+    }
+}
+
+void OnnxForceImpl::updateInputsInContext(ContextImpl& context) {
+    // All forces in a batch group share the extra inputs of the first one, so they cannot be changed.
+
+    if (batchGroup)
+        throw OpenMMException("updateInputsInContext: This cannot be used with BatchGroup");
+    // Any evaluation that is in progress used the old values, so its result will be discarded.
+
+    waitForAsyncEvaluation();
+    resultValid = false;
+    energyValid = false;
+    loadExtraInputs(false);
+    context.systemChanged();
+}
+
+void OnnxForceImpl::updateParticleIndicesInContext(ContextImpl& context) {
+    // Batching, domain decomposition, and graphs all depend on the number of particles staying fixed.
+
+    if (domains)
+        throw OpenMMException("updateParticleIndicesInContext: This cannot be used with multiple devices");
+    if (batchGroup)
+        throw OpenMMException("updateParticleIndicesInContext: This cannot be used with BatchGroup");
+    if (getBoolProperty(owner, "UseGraphs"))
+        throw OpenMMException("updateParticleIndicesInContext: This cannot be used with UseGraphs");
+    if (getBoolProperty(owner, "TensorRTFixedShapes"))
+        throw OpenMMException("updateParticleIndicesInContext: This cannot be used with TensorRTFixedShapes");
+    waitForAsyncEvaluation();
+    resultValid = false;
+    energyValid = false;
+    loadParticleIndices(context.getSystem().getNumParticles());
+    clearForces = true;
+
+    // The positions have a dynamic size, so the same session can be used for any number of particles.  Only
+    // the buffers that depend on it need to be resized.  They keep their storage when they shrink, so
+    // moving particles in and out of the subset does not keep reallocating them.
 
     int numParticles = particleIndices.size();
-    for (int i = 0; i < numParticles; i++) {
-        int index = particleIndices[i];
-        positionVec[3*i] = (float) positions[index][0];
-        positionVec[3*i+1] = (float) positions[index][1];
-        positionVec[3*i+2] = (float) positions[index][2];
+    auto memoryInfo = MemoryInfo::CreateCpu(OrtDeviceAllocator, OrtMemTypeCPU);
+    positionData.resize(positionData.getType(), 3*numParticles);
+    inputTensors[0] = positionData.createTensor(memoryInfo, {numParticles, 3});
+    markInputChanged(0);
+    lastPositions.resize(numParticles);
+    forceData.resize(forceData.getType(), 3*numParticles);
+    outputTensors[1] = forceData.createTensor(memoryInfo, {numParticles, 3});
+    binding.BindOutput("forces", outputTensors[1]);
+    for (AdditionalModel& additional : additionalModels) {
+        additional.forceData.resize(additional.forceData.getType(), 3*numParticles);
+        additional.outputTensors[1] = additional.forceData.createTensor(memoryInfo, {numParticles, 3});
+        additional.binding.BindOutput("forces", additional.outputTensors[1]);
+    }
+    if (neighborList)
+        neighborList->invalidate();
+
+    // Inputs that have one element per particle must change size along with the subset.
+
+    loadExtraInputs(true);
+    context.systemChanged();
+}
+
+void OnnxForceImpl::loadParticleIndices(int numSystemParticles) {
+    particleIndices = owner.getParticleIndices();
+    if (particleIndices.size() == 0)
+        for (int i = 0; i < numSystemParticles; i++)
+            particleIndices.push_back(i);
+    for (int index : particleIndices)
+        if (index < 0 || index >= numSystemParticles)
+            throw OpenMMException("OnnxForce: Illegal particle index: "+to_string(index));
+    contiguousIndices = true;
+    for (int i = 1; i < particleIndices.size(); i++)
+        if (particleIndices[i] != particleIndices[0]+i)
+            contiguousIndices = false;
+}
+
+void OnnxForceImpl::loadExtraInputs(bool allowShapeChange) {
+    auto memoryInfo = MemoryInfo::CreateCpu(OrtDeviceAllocator, OrtMemTypeCPU);
+    for (int i = 0; i < owner.getNumInputs(); i++) {
+        const OnnxForce::Input& input = owner.getInput(i);
+        Value& tensor = inputTensors[numDynamicInputs+i];
+        vector<int64_t> shape(input.getShape().begin(), input.getShape().end());
+        bool shapeChanged = (shape != tensor.GetTensorTypeAndShapeInfo().GetShape());
+        if (shapeChanged && !allowShapeChange)
+            throw OpenMMException("updateInputsInContext: The shape of input '"+input.getName()+"' has changed");
+        const OnnxForce::IntegerInput* integerInput = dynamic_cast<const OnnxForce::IntegerInput*>(&input);
+        const OnnxForce::FloatInput* floatInput = dynamic_cast<const OnnxForce::FloatInput*>(&input);
+        int size = (integerInput != nullptr ? integerInput->getValues().size() : floatInput->getValues().size());
+        validateInput(input.getName(), input.getShape(), size);
+        if (shapeChanged) {
+            extraInputData[i].resize(extraInputData[i].getType(), size);
+            tensor = extraInputData[i].createTensor(memoryInfo, shape);
+        }
+        if (integerInput != nullptr)
+            extraInputData[i].setValues(integerInput->getValues().data(), integerInput->getValues().size());
+        if (floatInput != nullptr)
+            extraInputData[i].setValues(floatInput->getValues().data(), floatInput->getValues().size());
+
+        // Binding the input again copies the new values to the device.
+
+        if (!batchGroup && !domains)
+            binding.BindInput(inputNames[numDynamicInputs+i], tensor);
+        if (energySession)
+            energyBinding.BindInput(inputNames[numDynamicInputs+i], tensor);
+        for (AdditionalModel& additional : additionalModels)
+            if (additional.usesInput[numDynamicInputs+i])
+                additional.binding.BindInput(inputNames[numDynamicInputs+i], tensor);
     }
+}
+
+void OnnxForceImpl::forEachBlock(const function<void (int, int)>& task) {
+    int numParticles = particleIndices.size();
+    if (!conversionThreads) {
+        task(0, numParticles);
+        return;
+    }
+    int numThreads = conversionThreads->getNumThreads();
+    conversionThreads->execute([&] (ThreadPool& pool, int threadIndex) {
+        task((threadIndex*numParticles)/numThreads, ((threadIndex+1)*numParticles)/numThreads);
+    });
+    conversionThreads->waitForThreads();
+}
+
+void OnnxForceImpl::setInputs(ContextImpl& context, const vector<Vec3>& positions) {
+    // Positions almost always change, so they are always copied.  The box and parameters are only copied,
+    // and only bound to the model again, when they have changed.
+
+    auto startTime = startTimer();
+    forEachBlock([&] (int start, int end) {
+        positionData.gatherVectors(positions, particleIndices, contiguousIndices, start, end);
+        for (int i = start; i < end; i++)
+            lastPositions[i] = positions[particleIndices[i]];
+    });
+    markInputChanged(0);
+    int firstParamIndex = 1;
     if (owner.usesPeriodicBoundaryConditions()) {
         Vec3 box[3];
         context.getPeriodicBoxVectors(box[0], box[1], box[2]);
-        for (int i = 0; i < 3; i++)
+        if (box[0] != lastBox[0] || box[1] != lastBox[1] || box[2] != lastBox[2]) {
+            for (int i = 0; i < 3; i++) {
+                lastBox[i] = box[i];
+                for (int j = 0; j < 3; j++)
+                    boxData.setValue(3*i+j, box[i][j]);
+            }
+            markInputChanged(1);
+        }
+        firstParamIndex = 2;
+    }
+    if (neighborList)
+        updateNeighborList(positions);
+    stopTimer(GatherPhase, startTime);
+    startTime = startTimer();
+    for (int i = 0; i < paramValues.size(); i++)
+        if (*paramValues[i] != lastParams[i]) {
+            lastParams[i] = *paramValues[i];
+            paramData[i].setValue(0, lastParams[i]);
+            markInputChanged(firstParamIndex+i);
+        }
+    stopTimer(ParametersPhase, startTime);
+}
+
+chrono::steady_clock::time_point OnnxForceImpl::startTimer() const {
+    if (!enableTiming)
+        return chrono::steady_clock::time_point();
+    return chrono::steady_clock::now();
+}
+
+void OnnxForceImpl::stopTimer(Phase phase, chrono::steady_clock::time_point start) {
+    if (!enableTiming)
+        return;
+    double elapsed = chrono::duration<double>(chrono::steady_clock::now()-start).count();
+    lock_guard<mutex> lock(timingMutex);
+    totalTime[phase] += elapsed;
+    lastTime[phase] = elapsed;
+}
+
+map<string, double> OnnxForceImpl::getEnergyParameterDerivatives() const {
+    map<string, double> derivatives;
+    for (int i = 0; i < parameterDerivatives.size(); i++)
+        derivatives[owner.getEnergyParameterDerivativeName(i)] = parameterDerivatives[i];
+    return derivatives;
+}
+
+map<string, double> OnnxForceImpl::getTimingStatistics() const {
+    const char* phaseNames[] = {"parameters", "gather", "run", "scatter"};
+    lock_guard<mutex> lock(timingMutex);
+    map<string, double> statistics;
+    statistics["calls"] = numCalls;
+    statistics["evaluations"] = numEvaluations;
+    statistics["sharedSession"] = (sharedSession ? 1 : 0);
+    if (batchGroup)
+        statistics["batchSize"] = lastBatchSize;
+    for (int i = 0; i < NumPhases; i++) {
+        statistics[string(phaseNames[i])+"Total"] = totalTime[i];
+        statistics[string(phaseNames[i])+"Last"] = lastTime[i];
+    }
+    return statistics;
+}
+
+void OnnxForceImpl::updateNeighborList(const vector<Vec3>& positions) {
+    if (!neighborList->update(positions, particleIndices, lastBox))
+        return;
+
+    // The list was rebuilt, so create new tensors for it.  Rebuilding also happens whenever the box
+    // changes, so the shifts only need to be computed here.
+
+    auto memoryInfo = MemoryInfo::CreateCpu(OrtDeviceAllocator, OrtMemTypeCPU);
+    int numPairs = neighborList->getNumPairs();
+    neighborData.resize(neighborData.getType(), 2*numPairs);
+    neighborData.setValues(neighborList->getPairs().data(), 2*numPairs);
+    inputTensors[neighborInputIndex] = neighborData.createTensor(memoryInfo, {2, numPairs});
+    if (hasNeighborShifts) {
+        const vector<int>& offsets = neighborList->getImageOffsets();
+        shiftData.resize(shiftData.getType(), 3*numPairs);
+        for (int i = 0; i < numPairs; i++) {
+            Vec3 shift;
+            if (owner.usesPeriodicBoundaryConditions())
+                shift = lastBox[0]*offsets[3*i] + lastBox[1]*offsets[3*i+1] + lastBox[2]*offsets[3*i+2];
             for (int j = 0; j < 3; j++)
-                boxVectors[3*i+j] = (float) box[i][j];
+                shiftData.setValue(3*i+j, shift[j]);
+        }
+        inputTensors[neighborInputIndex+1] = shiftData.createTensor(memoryInfo, {numPairs, 3});
+        markInputChanged(neighborInputIndex+1);
     }
-    for (int i = 0; i < owner.getNumGlobalParameters(); i++)
-        paramVec[i] = (float) context.getParameter(owner.getGlobalParameterName(i));
+    markInputChanged(neighborInputIndex);
+}
 
-    // Perform the computation.
+void OnnxForceImpl::markInputChanged(int index) {
+    inputChanged[index] = true;
+    energyInputChanged[index] = true;
+    for (AdditionalModel& additional : additionalModels)
+        additional.inputChanged[index] = true;
+}
 
-    const char* outputNames[] = {"energy", "forces"};
-    outputTensors = session.Run(RunOptions{nullptr}, inputNames.data(), inputTensors.data(), inputNames.size(), outputNames, 2);
-    const float* energy = outputTensors[0].GetTensorData<float>();
-    const float* forceData = outputTensors[1].GetTensorData<float>();
-    for (int i = 0; i < numParticles; i++)
-        forces[particleIndices[i]] = Vec3(forceData[3*i], forceData[3*i+1], forceData[3*i+2]);
-    return *energy;
+bool OnnxForceImpl::inputsMatch(ContextImpl& context, const vector<Vec3>& positions) {
+    // This compares the current state to the one that was last passed to setInputs().  The values are
+    // compared exactly, so a match guarantees the model would produce the same result.
+
+    for (int i = 0; i < particleIndices.size(); i++)
+        if (positions[particleIndices[i]] != lastPositions[i])
+            return false;
+    if (owner.usesPeriodicBoundaryConditions()) {
+        Vec3 box[3];
+        context.getPeriodicBoxVectors(box[0], box[1], box[2]);
+        for (int i = 0; i < 3; i++)
+            if (box[i] != lastBox[i])
+                return false;
+    }
+    for (int i = 0; i < paramValues.size(); i++)
+        if (lastParams[i] != *paramValues[i])
+            return false;
+    return true;
+}
+
+void OnnxForceImpl::evaluateModel(bool includeForces) {
+    auto startTime = startTimer();
+    int batchSize = 1;
+    if (domains)
+        domains->compute(lastPositions, lastBox, energyData, forceData);
+    else if (batchGroup)
+        batchSize = batchGroup->compute(positionData, boxData, paramData, &inputNames[numDynamicInputs], &inputTensors[numDynamicInputs],
+                inputTensors.size()-numDynamicInputs, energyData, forceData);
+    else {
+        bool energyOnly = (!includeForces && energySession);
+        IoBinding& activeBinding = (energyOnly ? energyBinding : binding);
+        vector<bool>& changed = (energyOnly ? energyInputChanged : inputChanged);
+        for (int i = 0; i < numDynamicInputs; i++)
+            if (changed[i]) {
+                activeBinding.BindInput(inputNames[i], inputTensors[i]);
+                changed[i] = false;
+            }
+        activeBinding.SynchronizeInputs();
+        (energyOnly ? energySession : session)->Run(RunOptions{nullptr}, activeBinding);
+
+        // Evaluate any additional models right after the main one.  Only inputs they use are rebound.
+
+        for (AdditionalModel& additional : additionalModels) {
+            for (int i = 0; i < numDynamicInputs; i++)
+                if (additional.usesInput[i] && additional.inputChanged[i]) {
+                    additional.binding.BindInput(inputNames[i], inputTensors[i]);
+                    additional.inputChanged[i] = false;
+                }
+            additional.binding.SynchronizeInputs();
+            additional.session->Run(RunOptions{nullptr}, additional.binding);
+        }
+        activeBinding.SynchronizeOutputs();
+        for (AdditionalModel& additional : additionalModels)
+            additional.binding.SynchronizeOutputs();
+    }
+    stopTimer(RunPhase, startTime);
+    if (enableTiming) {
+        lock_guard<mutex> lock(timingMutex);
+        numEvaluations++;
+        lastBatchSize = batchSize;
+    }
+}
+
+double OnnxForceImpl::computeForce(ContextImpl& context, const vector<Vec3>& positions, vector<Vec3>& forces) {
+    // If an asynchronous evaluation was started, wait for it to finish.
+
+    if (asyncPending) {
+        waitForAsyncEvaluation();
+        if (asyncError) {
+            exception_ptr error = asyncError;
+            asyncError = nullptr;
+            rethrow_exception(error);
+        }
+        resultValid = true;
+        energyValid = true;
+    }
+
+    // Only forces on particles in the subset are written, so if the subset has changed, any particle
+    // that was removed from it would keep its old force.
+
+    if (forcesRequested && clearForces) {
+        fill(forces.begin(), forces.end(), Vec3());
+        clearForces = false;
+    }
+
+    // With multiple time stepping, forces are only applied on steps that are a multiple of the evaluation
+    // interval, and are multiplied by the interval so they deliver the same impulse as applying them on every
+    // step.  On other steps no force is applied.  The energy is never scaled, and is computed whenever it is
+    // requested.
+
+    bool applyForces = forcesRequested;
+    double forceScale = 1.0;
+    if (forcesRequested && evaluationInterval > 1) {
+        if (context.getStepCount()%evaluationInterval == 0)
+            forceScale = evaluationInterval;
+        else {
+            applyForces = false;
+            forEachBlock([&] (int start, int end) {
+                for (int i = start; i < end; i++)
+                    forces[particleIndices[i]] = Vec3();
+            });
+        }
+    }
+
+    // OpenMM often requests forces several times for the same state.  Only evaluate the model if
+    // something has changed since the last evaluation.  If only the energy is needed and there is an
+    // energy-only model, use it instead.
+
+    if (applyForces || energyRequested) {
+        bool includeForces = (applyForces || !energySession);
+        bool valid = (includeForces ? resultValid : energyValid);
+        if (!valid || !inputsMatch(context, positions)) {
+            resultValid = false;
+            energyValid = false;
+            setInputs(context, positions);
+            evaluateModel(includeForces);
+            resultValid = includeForces;
+            energyValid = true;
+        }
+    }
+    if (applyForces) {
+        auto startTime = startTimer();
+        forEachBlock([&] (int start, int end) {
+            forceData.scatterVectors(forces, particleIndices, contiguousIndices, start, end);
+            for (const AdditionalModel& additional : additionalModels)
+                additional.forceData.addToVectors(forces, particleIndices, start, end);
+            if (forceScale != 1.0)
+                for (int i = start; i < end; i++)
+                    forces[particleIndices[i]] = forces[particleIndices[i]]*forceScale;
+        });
+        stopTimer(ScatterPhase, startTime);
+        for (int i = 0; i < parameterDerivatives.size(); i++)
+            parameterDerivatives[i] = derivativeData.getValue(i);
+    }
+    if (enableTiming) {
+        lock_guard<mutex> lock(timingMutex);
+        numCalls++;
+    }
+    double energy = energyData.getValue(0);
+    for (const AdditionalModel& additional : additionalModels)
+        energy += additional.energyData.getValue(0);
+    return energy;
 }
@@ -0,0 +1,198 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2025 Stanford University and the Authors.           *
+ * Authors: Peter Eastman                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+
+#include "OnnxNeighborList.h"
+#include "openmm/OpenMMException.h"
+#include <algorithm>
+#include <cmath>
+
+using namespace OnnxPlugin;
+using namespace OpenMM;
+using namespace std;
+
+OnnxNeighborList::OnnxNeighborList(double cutoff, double skin, bool periodic) : cutoff(cutoff), skin(skin), periodic(periodic), built(false) {
+}
+
+bool OnnxNeighborList::update(const vector<Vec3>& positions, const vector<int>& indices, const Vec3* box) {
+    int numParticles = indices.size();
+
+    // Decide whether the list needs to be rebuilt.
+
+    bool rebuild = !built;
+    if (periodic && built)
+        for (int i = 0; i < 3; i++)
+            if (box[i] != lastBox[i])
+                rebuild = true;
+    if (!rebuild) {
+        double maxDist2 = 0.25*skin*skin;
+        for (int i = 0; i < numParticles; i++) {
+            Vec3 delta = positions[indices[i]]-lastPositions[i];
+            if (delta.dot(delta) > maxDist2) {
+                rebuild = true;
+                break;
+            }
+        }
+    }
+    if (!rebuild)
+        return false;
+    built = true;
+    lastPositions.resize(numParticles);
+    for (int i = 0; i < numParticles; i++)
+        lastPositions[i] = positions[indices[i]];
+    pairs.clear();
+    offsets.clear();
+    if (numParticles == 0)
+        return true;
+
+    // Compute the coordinates of each particle relative to the cell grid.  For periodic systems these
+    // are fractional coordinates in the (reduced, triclinic) box.  For non-periodic systems they are
+    // relative to the bounding box of the particles.
+
+    double width = cutoff+skin;
+    vector<Vec3> scaled(numParticles);
+    int numCells[3];
+    if (periodic) {
+        // Each cell must be at least the cutoff plus skin wide, measured perpendicular to its faces.  In a
+        // triclinic box that is less than the diagonal element of the box vector, so compute the distance
+        // between the planes spanned by the other two box vectors.
+
+        double volume = box[0][0]*box[1][1]*box[2][2];
+        Vec3 bc = box[1].cross(box[2]), ac = box[0].cross(box[2]);
+        double boxWidth[3] = {volume/sqrt(bc.dot(bc)), volume/sqrt(ac.dot(ac)), box[2][2]};
+        if (2*width > min(boxWidth[0], min(boxWidth[1], boxWidth[2])))
+            throw OpenMMException("OnnxForce: NeighborCutoff plus NeighborSkin cannot be larger than half the periodic box width");
+        for (int i = 0; i < numParticles; i++) {
+            const Vec3& r = lastPositions[i];
+            double sz = r[2]/box[2][2];
+            double sy = (r[1]-sz*box[2][1])/box[1][1];
+            double sx = (r[0]-sz*box[2][0]-sy*box[1][0])/box[0][0];
+            scaled[i] = Vec3(sx-floor(sx), sy-floor(sy), sz-floor(sz));
+        }
+        for (int k = 0; k < 3; k++)
+            numCells[k] = max(1, (int) floor(boxWidth[k]/width));
+    }
+    else {
+        Vec3 minPos = lastPositions[0], maxPos = lastPositions[0];
+        for (const Vec3& r : lastPositions)
+            for (int k = 0; k < 3; k++) {
+                minPos[k] = min(minPos[k], r[k]);
+                maxPos[k] = max(maxPos[k], r[k]);
+            }
+        for (int k = 0; k < 3; k++)
+            numCells[k] = max(1, (int) floor((maxPos[k]-minPos[k])/width));
+        for (int i = 0; i < numParticles; i++)
+            for (int k = 0; k < 3; k++)
+                scaled[i][k] = (maxPos[k] > minPos[k] ? (lastPositions[i][k]-minPos[k])/(maxPos[k]-minPos[k]) : 0.0);
+    }
+
+    // A sparse system could have far more cells than particles.  Making cells larger is always valid, so
+    // reduce the number of cells until it is proportional to the number of particles.
+
+    while ((long long) numCells[0]*numCells[1]*numCells[2] > 2*numParticles+27) {
+        int largest = (numCells[0] >= numCells[1] && numCells[0] >= numCells[2] ? 0 : (numCells[1] >= numCells[2] ? 1 : 2));
+        numCells[largest] = max(1, numCells[largest]/2);
+    }
+
+    // Sort the particles into cells.
+
+    int totalCells = numCells[0]*numCells[1]*numCells[2];
+    vector<int> cellIndex(numParticles), cellStart(totalCells+1, 0), cellParticles(numParticles);
+    for (int i = 0; i < numParticles; i++) {
+        int cell[3];
+        for (int k = 0; k < 3; k++)
+            cell[k] = min((int) (scaled[i][k]*numCells[k]), numCells[k]-1);
+        cellIndex[i] = (cell[2]*numCells[1]+cell[1])*numCells[0]+cell[0];
+        cellStart[cellIndex[i]+1]++;
+    }
+    for (int i = 0; i < totalCells; i++)
+        cellStart[i+1] += cellStart[i];
+    vector<int> cellFill(cellStart.begin(), cellStart.end()-1);
+    for (int i = 0; i < numParticles; i++)
+        cellParticles[cellFill[cellIndex[i]]++] = i;
+
+    // Find the neighbors of each particle by searching the adjacent cells.  When there are fewer than
+    // three cells along an axis, the adjacent cells overlap, so duplicates must be skipped.
+
+    double width2 = width*width;
+    vector<int> first, second;
+    for (int cz = 0; cz < numCells[2]; cz++)
+        for (int cy = 0; cy < numCells[1]; cy++)
+            for (int cx = 0; cx < numCells[0]; cx++) {
+                int center[3] = {cx, cy, cz};
+                vector<int> neighborCells[3];
+                for (int k = 0; k < 3; k++)
+                    for (int offset = -1; offset <= 1; offset++) {
+                        int c = center[k]+offset;
+                        if (periodic)
+                            c = (c+numCells[k])%numCells[k];
+                        else if (c < 0 || c >= numCells[k])
+                            continue;
+                        if (find(neighborCells[k].begin(), neighborCells[k].end(), c) == neighborCells[k].end())
+                            neighborCells[k].push_back(c);
+                    }
+                int cell = (cz*numCells[1]+cy)*numCells[0]+cx;
+                for (int nz : neighborCells[2])
+                    for (int ny : neighborCells[1])
+                        for (int nx : neighborCells[0]) {
+                            int neighbor = (nz*numCells[1]+ny)*numCells[0]+nx;
+                            for (int a = cellStart[cell]; a < cellStart[cell+1]; a++) {
+                                int i = cellParticles[a];
+                                for (int b = cellStart[neighbor]; b < cellStart[neighbor+1]; b++) {
+                                    int j = cellParticles[b];
+                                    if (i == j)
+                                        continue;
+                                    Vec3 delta = lastPositions[j]-lastPositions[i];
+                                    int image[3] = {0, 0, 0};
+                                    if (periodic) {
+                                        image[2] = (int) -round(delta[2]/box[2][2]);
+                                        delta += box[2]*image[2];
+                                        image[1] = (int) -round(delta[1]/box[1][1]);
+                                        delta += box[1]*image[1];
+                                        image[0] = (int) -round(delta[0]/box[0][0]);
+                                        delta += box[0]*image[0];
+                                    }
+                                    if (delta.dot(delta) < width2) {
+                                        first.push_back(i);
+                                        second.push_back(j);
+                                        offsets.insert(offsets.end(), image, image+3);
+                                    }
+                                }
+                            }
+                        }
+            }
+    pairs = first;
+    pairs.insert(pairs.end(), second.begin(), second.end());
+    if (periodic)
+        for (int i = 0; i < 3; i++)
+            lastBox[i] = box[i];
+    return true;
+}
@@ -0,0 +1,101 @@
+#ifndef OPENMM_ONNXNEIGHBORLIST_H_
+#define OPENMM_ONNXNEIGHBORLIST_H_
+
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2025 Stanford University and the Authors.           *
+ * Authors: Peter Eastman                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+#include "openmm/Vec3.h"
+#include <vector>
+
+namespace OnnxPlugin {
+
+/**
+ * This class builds a list of neighboring particle pairs that is passed to the model.  It includes
+ * every pair whose distance is less than the cutoff plus a skin distance.  The list is only rebuilt
+ * when some particle has moved more than half the skin distance, or the periodic box has changed,
+ * so between rebuilds it still contains every pair within the cutoff.
+ *
+ * Each pair is included in both directions.  For a pair (i, j), the displacement from particle i to
+ * particle j is positions[j]-positions[i]+shift, where the shift is an integer combination of the
+ * periodic box vectors.
+ */
+
+class OnnxNeighborList {
+public:
+    OnnxNeighborList(double cutoff, double skin, bool periodic);
+    /**
+     * Update the neighbor list, rebuilding it if necessary.
+     *
+     * @param positions   the positions of all particles in the System
+     * @param indices     the indices of the particles to include in the list.  The pairs refer to
+     *                    positions within this list, not to the original particle indices.
+     * @param box         the periodic box vectors.  This is ignored if the list is not periodic.
+     * @return true if the list was rebuilt, false if it is unchanged
+     */
+    bool update(const std::vector<OpenMM::Vec3>& positions, const std::vector<int>& indices, const OpenMM::Vec3* box);
+    /**
+     * Force the list to be rebuilt the next time update() is called.  This must be called whenever the
+     * set of particles changes.
+     */
+    void invalidate() {
+        built = false;
+    }
+    /**
+     * Get the number of pairs in the list.
+     */
+    int getNumPairs() const {
+        return pairs.size()/2;
+    }
+    /**
+     * Get the pairs, in the form of a [2, numPairs] array.  The first row contains the first particle
+     * of each pair and the second row contains the second particle.
+     */
+    const std::vector<int>& getPairs() const {
+        return pairs;
+    }
+    /**
+     * Get the number of times each periodic box vector should be added to the displacement of each
+     * pair, in the form of a [numPairs, 3] array.
+     */
+    const std::vector<int>& getImageOffsets() const {
+        return offsets;
+    }
+private:
+    double cutoff, skin;
+    bool periodic, built;
+    std::vector<OpenMM::Vec3> lastPositions;
+    OpenMM::Vec3 lastBox[3];
+    std::vector<int> pairs, offsets;
+};
+
+} // namespace OnnxPlugin
+
+#endif /*OPENMM_ONNXNEIGHBORLIST_H_*/
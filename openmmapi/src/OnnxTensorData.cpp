@@ -0,0 +1,219 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2025 Stanford University and the Authors.           *
+ * Authors: Peter Eastman                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+
+#include "OnnxTensorData.h"
+#include "openmm/OpenMMException.h"
+#include <algorithm>
+
+using namespace OnnxPlugin;
+using namespace OpenMM;
+using namespace std;
+using namespace Ort;
+
+// Telling the compiler that source and destination arrays never overlap lets it vectorize the conversion
+// loops.  MSVC and GCC/Clang spell the qualifier differently.
+
+#ifdef _MSC_VER
+    #define ONNX_RESTRICT __restrict
+#else
+    #define ONNX_RESTRICT __restrict__
+#endif
+
+template <class T>
+static inline T fromDouble(double x) {
+    return (T) x;
+}
+
+template <>
+inline Float16_t fromDouble<Float16_t>(double x) {
+    return Float16_t((float) x);
+}
+
+template <>
+inline BFloat16_t fromDouble<BFloat16_t>(double x) {
+    return BFloat16_t((float) x);
+}
+
+template <class T>
+static inline double toDouble(T x) {
+    return (double) x;
+}
+
+template <>
+inline double toDouble<Float16_t>(Float16_t x) {
+    return x.ToFloat();
+}
+
+template <>
+inline double toDouble<BFloat16_t>(BFloat16_t x) {
+    return x.ToFloat();
+}
+
+template <class T, class S>
+static void convertArray(const S* ONNX_RESTRICT source, T* ONNX_RESTRICT dest, size_t count) {
+    for (size_t i = 0; i < count; i++)
+        dest[i] = fromDouble<T>(source[i]);
+}
+
+template <class S>
+static void convertToDouble(const S* ONNX_RESTRICT source, double* ONNX_RESTRICT dest, size_t count) {
+    for (size_t i = 0; i < count; i++)
+        dest[i] = toDouble(source[i]);
+}
+
+// Vec3 stores its three components contiguously, so a contiguous range of vectors can be treated as a
+// flat array of doubles.  The loops over flat arrays are simple enough for the compiler to vectorize.
+
+template <class T>
+static void gather(const vector<Vec3>& vectors, const vector<int>& indices, bool contiguous, int start, int end, T* ONNX_RESTRICT dest) {
+    if (contiguous) {
+        convertArray(&vectors[indices[start]][0], dest+3*start, 3*(end-start));
+        return;
+    }
+    for (int i = start; i < end; i++) {
+        const Vec3& v = vectors[indices[i]];
+        dest[3*i] = fromDouble<T>(v[0]);
+        dest[3*i+1] = fromDouble<T>(v[1]);
+        dest[3*i+2] = fromDouble<T>(v[2]);
+    }
+}
+
+template <class T>
+static void scatter(const T* ONNX_RESTRICT source, const vector<int>& indices, bool contiguous, int start, int end, vector<Vec3>& vectors) {
+    if (contiguous) {
+        convertToDouble(source+3*start, &vectors[indices[start]][0], 3*(end-start));
+        return;
+    }
+    for (int i = start; i < end; i++)
+        vectors[indices[i]] = Vec3(toDouble(source[3*i]), toDouble(source[3*i+1]), toDouble(source[3*i+2]));
+}
+
+template <class T>
+static void add(const T* ONNX_RESTRICT source, const vector<int>& indices, int start, int end, vector<Vec3>& vectors) {
+    for (int i = start; i < end; i++)
+        vectors[indices[i]] += Vec3(toDouble(source[3*i]), toDouble(source[3*i+1]), toDouble(source[3*i+2]));
+}
+
+// This macro invokes a statement with ElementType defined as the C++ type corresponding to a
+// floating point element type.
+
+#define DISPATCH_FLOAT_TYPE(type, statement) \
+    switch (type) { \
+        case ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT: { typedef float ElementType; statement; break; } \
+        case ONNX_TENSOR_ELEMENT_DATA_TYPE_DOUBLE: { typedef double ElementType; statement; break; } \
+        case ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT16: { typedef Float16_t ElementType; statement; break; } \
+        case ONNX_TENSOR_ELEMENT_DATA_TYPE_BFLOAT16: { typedef BFloat16_t ElementType; statement; break; } \
+        default: throw OpenMMException("Unsupported element type for tensor: "+getTypeName(type)); \
+    }
+
+// This is the same, but for any supported element type.
+
+#define DISPATCH_TYPE(type, statement) \
+    switch (type) { \
+        case ONNX_TENSOR_ELEMENT_DATA_TYPE_INT32: { typedef int32_t ElementType; statement; break; } \
+        case ONNX_TENSOR_ELEMENT_DATA_TYPE_INT64: { typedef int64_t ElementType; statement; break; } \
+        default: DISPATCH_FLOAT_TYPE(type, statement) \
+    }
+
+void OnnxTensorData::resize(ONNXTensorElementDataType type, size_t size) {
+    size_t bytes = size*getElementSize(type);
+    this->type = type;
+    this->size = size;
+    storage.resize(max((size_t) 1, (bytes+sizeof(double)-1)/sizeof(double)));
+}
+
+Value OnnxTensorData::createTensor(const OrtMemoryInfo* memoryInfo, const vector<int64_t>& shape) {
+    return Value::CreateTensor(memoryInfo, getData(), getBytes(), shape.data(), shape.size(), type);
+}
+
+void OnnxTensorData::setValue(size_t index, double value) {
+    DISPATCH_TYPE(type, reinterpret_cast<ElementType*>(getData())[index] = fromDouble<ElementType>(value));
+}
+
+double OnnxTensorData::getValue(size_t index) const {
+    double result = 0;
+    DISPATCH_TYPE(type, result = toDouble(reinterpret_cast<const ElementType*>(getData())[index]));
+    return result;
+}
+
+void OnnxTensorData::setValues(const float* values, size_t count) {
+    DISPATCH_TYPE(type, convertArray(values, reinterpret_cast<ElementType*>(getData()), count));
+}
+
+void OnnxTensorData::setValues(const int* values, size_t count) {
+    DISPATCH_TYPE(type, convertArray(values, reinterpret_cast<ElementType*>(getData()), count));
+}
+
+void OnnxTensorData::gatherVectors(const vector<Vec3>& vectors, const vector<int>& indices, bool contiguous, int start, int end) {
+    if (start < end)
+        DISPATCH_FLOAT_TYPE(type, gather(vectors, indices, contiguous, start, end, reinterpret_cast<ElementType*>(getData())));
+}
+
+void OnnxTensorData::scatterVectors(vector<Vec3>& vectors, const vector<int>& indices, bool contiguous, int start, int end) const {
+    if (start < end)
+        DISPATCH_FLOAT_TYPE(type, scatter(reinterpret_cast<const ElementType*>(getData()), indices, contiguous, start, end, vectors));
+}
+
+void OnnxTensorData::addToVectors(vector<Vec3>& vectors, const vector<int>& indices, int start, int end) const {
+    if (start < end)
+        DISPATCH_FLOAT_TYPE(type, add(reinterpret_cast<const ElementType*>(getData()), indices, start, end, vectors));
+}
+
+size_t OnnxTensorData::getElementSize(ONNXTensorElementDataType type) {
+    size_t result = 0;
+    DISPATCH_TYPE(type, result = sizeof(ElementType));
+    return result;
+}
+
+bool OnnxTensorData::isFloatingPoint(ONNXTensorElementDataType type) {
+    return (type == ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT || type == ONNX_TENSOR_ELEMENT_DATA_TYPE_DOUBLE ||
+            type == ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT16 || type == ONNX_TENSOR_ELEMENT_DATA_TYPE_BFLOAT16);
+}
+
+string OnnxTensorData::getTypeName(ONNXTensorElementDataType type) {
+    switch (type) {
+        case ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT:
+            return "float32";
+        case ONNX_TENSOR_ELEMENT_DATA_TYPE_DOUBLE:
+            return "float64";
+        case ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT16:
+            return "float16";
+        case ONNX_TENSOR_ELEMENT_DATA_TYPE_BFLOAT16:
+            return "bfloat16";
+        case ONNX_TENSOR_ELEMENT_DATA_TYPE_INT32:
+            return "int32";
+        case ONNX_TENSOR_ELEMENT_DATA_TYPE_INT64:
+            return "int64";
+        default:
+            return "type "+to_string((int) type);
+    }
+}
@@ -13,6 +13,78 @@
 #include "OpenMMDrude.h"
 #include "openmm/RPMDIntegrator.h"
 #include "openmm/RPMDMonteCarloBarostat.h"
+#include <cstring>
+#include <type_traits>
+
+template <class S, class T>
+static void convertBuffer(const void* buffer, size_t count, std::vector<T>& values) {
+    const S* source = reinterpret_cast<const S*>(buffer);
+    for (size_t i = 0; i < count; i++)
+        values[i] = (T) source[i];
+}
+
+/**
+ * Copy the contents of an object that supports the buffer protocol, such as a NumPy array, into a vector.
+ * This is much faster than converting one element at a time.  If the element types match, it is a single
+ * memcpy.  It returns false if the object does not provide a contiguous buffer of a supported type, in
+ * which case the caller should fall back to iterating over it.
+ */
+template <class T>
+static bool copyFromBuffer(PyObject* object, std::vector<T>& values) {
+    if (!PyObject_CheckBuffer(object))
+        return false;
+    Py_buffer view;
+    if (PyObject_GetBuffer(object, &view, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT) != 0) {
+        PyErr_Clear();
+        return false;
+    }
+    const char* format = (view.format == NULL ? "B" : view.format);
+    if (format[0] == '@' || format[0] == '=')
+        format++;
+    bool isFloat = (format[0] == 'f' || format[0] == 'd');
+    bool isInt = (format[0] != '\0' && strchr("bhilq", format[0]) != NULL);
+    bool supported = (format[0] != '\0' && format[1] == '\0' && (isFloat ? std::is_floating_point<T>::value : isInt));
+    if (supported) {
+        size_t count = view.len/view.itemsize;
+        values.resize(count);
+        if (view.itemsize == sizeof(T) && isFloat == std::is_floating_point<T>::value)
+            memcpy(values.data(), view.buf, view.len);
+        else if (isFloat && view.itemsize == 8)
+            convertBuffer<double>(view.buf, count, values);
+        else if (isFloat && view.itemsize == 4)
+            convertBuffer<float>(view.buf, count, values);
+        else if (view.itemsize == 8)
+            convertBuffer<int64_t>(view.buf, count, values);
+        else if (view.itemsize == 4)
+            convertBuffer<int32_t>(view.buf, count, values);
+        else if (view.itemsize == 2)
+            convertBuffer<int16_t>(view.buf, count, values);
+        else if (view.itemsize == 1)
+            convertBuffer<int8_t>(view.buf, count, values);
+        else
+            supported = false;
+    }
+    PyBuffer_Release(&view);
+    return supported;
+}
+
+/**
+ * Create a NumPy array containing a copy of the contents of a vector.  The data is copied once into a
+ * bytearray, which the array then uses as its storage.
+ */
+template <class T>
+static PyObject* copyToArray(const std::vector<T>& values, const char* dtype) {
+    PyObject* numpy = PyImport_ImportModule("numpy");
+    if (numpy == NULL)
+        return NULL;
+    PyObject* buffer = PyByteArray_FromStringAndSize(reinterpret_cast<const char*>(values.data()), values.size()*sizeof(T));
+    PyObject* result = NULL;
+    if (buffer != NULL)
+        result = PyObject_CallMethod(numpy, "frombuffer", "Os", buffer, dtype);
+    Py_XDECREF(buffer);
+    Py_DECREF(numpy);
+    return result;
+}
 %}
 
 %typemap(out) const std::vector<uint8_t>& {
@@ -20,17 +92,22 @@
 }
 
 %typemap(in) const std::vector<uint8_t>& (std::vector<uint8_t> model) {
-    uint8_t* buffer;
-    Py_ssize_t length;
-    PyBytes_AsStringAndSize($input, reinterpret_cast<char**>(&buffer), &length);
-    model.resize(length);
-    for (int i = 0; i < length; i++)
-        model[i] = buffer[i];
+    // Any object that supports the buffer protocol, such as bytes, bytearray, or memoryview, can be
+    // copied directly into the vector.
+
+    Py_buffer view;
+    if (PyObject_GetBuffer($input, &view, PyBUF_C_CONTIGUOUS) != 0) {
+        PyErr_SetString(PyExc_ValueError, "in method $symname, argument $argnum could not be converted to type $type");
+        SWIG_fail;
+    }
+    const uint8_t* buffer = reinterpret_cast<const uint8_t*>(view.buf);
+    model.assign(buffer, buffer+view.len);
+    PyBuffer_Release(&view);
     $1 = &model;
 }
 
 %typecheck(SWIG_TYPECHECK_POINTER) const std::vector<uint8_t>& {
-    $1 = PyBytes_Check($input);
+    $1 = PyObject_CheckBuffer($input);
 }
 
 %typemap(out) const std::vector<int>& {
@@ -41,23 +118,27 @@
 }
 
 %typemap(in) const std::vector<int>& (std::vector<int> values) {
-    PyObject* iterator = PyObject_GetIter($input);
-    if (iterator == NULL) {
-        PyErr_SetString(PyExc_ValueError, "in method $symname, argument $argnum could not be converted to type $type");
-        SWIG_fail;
-    }
-    PyObject* item = NULL;
-    while ((item = PyIter_Next(iterator))) {
-        int v = (int) PyLong_AsLong(item);
-        Py_DECREF(item);
-        if (PyErr_Occurred() != NULL) {
-            Py_DECREF(iterator);
+    // Arrays can be copied directly.  Anything else is converted one element at a time.
+
+    if (!copyFromBuffer($input, values)) {
+        PyObject* iterator = PyObject_GetIter($input);
+        if (iterator == NULL) {
             PyErr_SetString(PyExc_ValueError, "in method $symname, argument $argnum could not be converted to type $type");
             SWIG_fail;
         }
-        values.push_back(v);
+        PyObject* item = NULL;
+        while ((item = PyIter_Next(iterator))) {
+            int v = (int) PyLong_AsLong(item);
+            Py_DECREF(item);
+            if (PyErr_Occurred() != NULL) {
+                Py_DECREF(iterator);
+                PyErr_SetString(PyExc_ValueError, "in method $symname, argument $argnum could not be converted to type $type");
+                SWIG_fail;
+            }
+            values.push_back(v);
+        }
+        Py_DECREF(iterator);
     }
-    Py_DECREF(iterator);
     $1 = &values;
 }
 
@@ -75,23 +156,27 @@
 }
 
 %typemap(in) const std::vector<float>& (std::vector<float> values) {
-    PyObject* iterator = PyObject_GetIter($input);
-    if (iterator == NULL) {
-        PyErr_SetString(PyExc_ValueError, "in method $symname, argument $argnum could not be converted to type $type");
-        SWIG_fail;
-    }
-    PyObject* item = NULL;
-    while ((item = PyIter_Next(iterator))) {
-        float v = (float) PyFloat_AsDouble(item);
-        Py_DECREF(item);
-        if (PyErr_Occurred() != NULL) {
-            Py_DECREF(iterator);
+    // Arrays can be copied directly.  Anything else is converted one element at a time.
+
+    if (!copyFromBuffer($input, values)) {
+        PyObject* iterator = PyObject_GetIter($input);
+        if (iterator == NULL) {
             PyErr_SetString(PyExc_ValueError, "in method $symname, argument $argnum could not be converted to type $type");
             SWIG_fail;
         }
-        values.push_back(v);
+        PyObject* item = NULL;
+        while ((item = PyIter_Next(iterator))) {
+            float v = (float) PyFloat_AsDouble(item);
+            Py_DECREF(item);
+            if (PyErr_Occurred() != NULL) {
+                Py_DECREF(iterator);
+                PyErr_SetString(PyExc_ValueError, "in method $symname, argument $argnum could not be converted to type $type");
+                SWIG_fail;
+            }
+            values.push_back(v);
+        }
+        Py_DECREF(iterator);
     }
-    Py_DECREF(iterator);
     $1 = &values;
 }
 
@@ -101,6 +186,27 @@
     Py_DECREF(iterator);
 }
 
+%typemap(out) const std::vector<int>& getValues {
+    $result = copyToArray(*$1, "int32");
+    if ($result == NULL)
+        SWIG_fail;
+}
+
+%typemap(out) const std::vector<float>& getValues {
+    $result = copyToArray(*$1, "float32");
+    if ($result == NULL)
+        SWIG_fail;
+}
+
+%typemap(out) std::map<std::string, double> {
+    $result = PyDict_New();
+    for (auto& item : $1) {
+        PyObject* value = PyFloat_FromDouble(item.second);
+        PyDict_SetItemString($result, item.first.c_str(), value);
+        Py_DECREF(value);
+    }
+}
+
 %pythonappend OnnxPlugin::OnnxForce::addInput(Input* input) %{
    input.thisown=0
 %}
@@ -133,6 +239,16 @@ public:
     OnnxForce(const std::string& file, const std::map<std::string, std::string>& properties={});
     OnnxForce(const std::vector<uint8_t>& model, const std::map<std::string, std::string>& properties={});
     const std::vector<uint8_t>& getModel() const;
+    const std::string& getModelFile() const;
+    bool getSerializeModelAsReference() const;
+    void setSerializeModelAsReference(bool reference);
+    const std::vector<uint8_t>& getEnergyOnlyModel() const;
+    void setEnergyOnlyModel(const std::string& file);
+    void setEnergyOnlyModel(const std::vector<uint8_t>& model);
+    int getNumAdditionalModels() const;
+    const std::vector<uint8_t>& getAdditionalModel(int index) const;
+    int addAdditionalModel(const std::string& file);
+    int addAdditionalModel(const std::vector<uint8_t>& model);
     ExecutionProvider getExecutionProvider() const;
     void setExecutionProvider(ExecutionProvider provider);
     const std::vector<int>& getParticleIndices() const;
@@ -145,10 +261,18 @@ public:
     void setGlobalParameterName(int index, const std::string& name);
     double getGlobalParameterDefaultValue(int index) const;
     void setGlobalParameterDefaultValue(int index, double defaultValue);
+    void addEnergyParameterDerivative(const std::string& name);
+    int getNumEnergyParameterDerivatives() const;
+    const std::string& getEnergyParameterDerivativeName(int index) const;
     int getNumInputs() const;
     int addInput(Input* input);
     const Input& getInput(int index) const;
     Input& getInput(int index);
+    void updateInputsInContext(OpenMM::Context& context);
+    void updateParticleIndicesInContext(OpenMM::Context& context);
+    std::map<std::string, double> getTimingStatistics(const OpenMM::Context& context) const;
+    std::map<std::string, double> getEnergyParameterDerivatives(const OpenMM::Context& context) const;
+    bool isEvaluationStep(const OpenMM::Context& context) const;
     void setProperty(const std::string& name, const std::string& value);
     const std::map<std::string, std::string>& getProperties() const;
 
@@ -94,6 +94,42 @@ def testInputs(platform):
     assert np.array_equal(scale, force.getInput(0).getValues())
     assert np.allclose(offset, force.getInput(1).getValues())
 
+    # Change the inputs and update the Context.
+    scale = np.random.randint(5, size=numParticles)
+    offset = np.random.rand(numParticles)
+    force.getInput(0).setValues(scale)
+    force.getInput(1).setValues(offset)
+    force.updateInputsInContext(context)
+    state = context.getState(getEnergy=True, getForces=True)
+    expectedEnergy = np.sum(scale*(r2-offset))
+    assert np.allclose(expectedEnergy, state.getPotentialEnergy().value_in_unit(unit.kilojoules_per_mole))
+    forces = state.getForces(asNumpy=True)
+    assert np.allclose(-2*np.expand_dims(scale, 1)*positions, forces)
+
+def testArrayConversions():
+    """ Test passing arrays and buffers to and from the wrappers """
+    model = open('../../tests/central.onnx', 'rb').read()
+    for data in [bytearray(model), memoryview(model), np.frombuffer(model, dtype=np.uint8)]:
+        force = openmmonnx.OnnxForce(data)
+        assert model == force.getModel()
+    for dtype in [np.int32, np.int64, np.int8]:
+        values = np.arange(-5, 5, dtype=dtype)
+        input = openmmonnx.IntegerInput('ints', values, np.array([2, 5], dtype=dtype))
+        assert input.getValues().dtype == np.int32
+        assert np.array_equal(values, input.getValues())
+        assert input.getShape() == [2, 5]
+    for dtype in [np.float32, np.float64]:
+        values = np.linspace(0, 1, 10, dtype=dtype)
+        input = openmmonnx.FloatInput('floats', values, [10])
+        assert input.getValues().dtype == np.float32
+        assert np.allclose(values, input.getValues())
+
+    # Arrays that are not contiguous and lists should still work.
+    input = openmmonnx.FloatInput('floats', np.linspace(0, 1, 20)[::2], [10])
+    assert np.allclose(np.linspace(0, 1, 20)[::2], input.getValues())
+    input.setValues([1.0, 2.0])
+    assert np.allclose([1.0, 2.0], input.getValues())
+
 def testProperties():
     """ Test that the properties are correctly set and retrieved """
     force = openmmonnx.OnnxForce('../../tests/central.onnx')
@@ -102,6 +138,22 @@ def testProperties():
     force.setProperty('UseGraphs', 'false')
     assert force.getProperties()['UseGraphs'] == 'false'
 
+def testTimingStatistics():
+    system = mm.System()
+    for i in range(5):
+        system.addParticle(1.0)
+    force = openmmonnx.OnnxForce('../../tests/central.onnx')
+    force.setProperty('EnableTiming', 'true')
+    system.addForce(force)
+    integrator = mm.VerletIntegrator(0.001)
+    context = mm.Context(system, integrator, mm.Platform.getPlatformByName('Reference'))
+    context.setPositions(np.random.rand(5, 3))
+    context.getState(getForces=True)
+    stats = force.getTimingStatistics(context)
+    assert stats['calls'] == 1
+    assert stats['evaluations'] == 1
+    assert stats['runTotal'] > 0
+
 def testSerialization():
     force1 = openmmonnx.OnnxForce('../../tests/central.onnx')
     xml1 = mm.XmlSerializer.serialize(force1)
@@ -31,7 +31,10 @@
 
 #include "OnnxForceProxy.h"
 #include "OnnxForce.h"
+#include "openmm/OpenMMException.h"
 #include "openmm/serialization/SerializationNode.h"
+#include <algorithm>
+#include <cstring>
 #include <fstream>
 #include <iomanip>
 #include <sstream>
@@ -40,66 +43,168 @@ using namespace OnnxPlugin;
 using namespace OpenMM;
 using namespace std;
 
-static string hexEncode(const vector<uint8_t>& input) {
-    stringstream ss;
-    ss << hex << setfill('0');
-    for (const unsigned char& i : input) {
-        ss << setw(2) << static_cast<uint64_t>(i);
+static const char base64Chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static string base64Encode(const vector<uint8_t>& input) {
+    size_t size = input.size();
+    string result(4*((size+2)/3), '=');
+    char* out = &result[0];
+    size_t i = 0;
+    for (; i+2 < size; i += 3) {
+        uint32_t v = (input[i]<<16) | (input[i+1]<<8) | input[i+2];
+        *out++ = base64Chars[(v>>18)&63];
+        *out++ = base64Chars[(v>>12)&63];
+        *out++ = base64Chars[(v>>6)&63];
+        *out++ = base64Chars[v&63];
     }
-    return ss.str();
+    if (i < size) {
+        uint32_t v = input[i]<<16;
+        if (i+1 < size)
+            v |= input[i+1]<<8;
+        out[0] = base64Chars[(v>>18)&63];
+        out[1] = base64Chars[(v>>12)&63];
+        if (i+1 < size)
+            out[2] = base64Chars[(v>>6)&63];
+    }
+    return result;
+}
+
+static vector<uint8_t> base64Decode(const string& input) {
+    int8_t table[256];
+    fill(table, table+256, -1);
+    for (int i = 0; i < 64; i++)
+        table[(uint8_t) base64Chars[i]] = i;
+    size_t size = input.size();
+    if (size%4 != 0)
+        throw OpenMMException("Illegal base64 data: length is not a multiple of 4");
+    size_t padding = 0;
+    if (size > 0 && input[size-1] == '=')
+        padding = (input[size-2] == '=' ? 2 : 1);
+    vector<uint8_t> result(3*(size/4)-padding);
+    uint8_t* out = result.data();
+    const uint8_t* in = reinterpret_cast<const uint8_t*>(input.data());
+    for (size_t i = 0; i < size; i += 4) {
+        int8_t c0 = table[in[i]], c1 = table[in[i+1]];
+        bool last = (i+4 == size);
+        int8_t c2 = (last && padding == 2 ? 0 : table[in[i+2]]);
+        int8_t c3 = (last && padding > 0 ? 0 : table[in[i+3]]);
+        if ((c0|c1|c2|c3) < 0)
+            throw OpenMMException("Illegal character in base64 data");
+        uint32_t v = (c0<<18) | (c1<<12) | (c2<<6) | c3;
+        size_t remaining = result.size()-3*(i/4);
+        *out++ = (v>>16)&255;
+        if (remaining > 1)
+            *out++ = (v>>8)&255;
+        if (remaining > 2)
+            *out++ = v&255;
+    }
+    return result;
 }
 
 static vector<uint8_t> hexDecode(const string& input) {
-    vector<uint8_t> res;
-    res.reserve(input.size() / 2);
-    for (size_t i = 0; i < input.length(); i += 2) {
-        istringstream iss(input.substr(i, 2));
-        uint64_t temp;
-        iss >> hex >> temp;
-        res.push_back(static_cast<uint8_t>(temp));
+    int8_t table[256];
+    fill(table, table+256, -1);
+    for (int i = 0; i < 10; i++)
+        table['0'+i] = i;
+    for (int i = 0; i < 6; i++) {
+        table['a'+i] = 10+i;
+        table['A'+i] = 10+i;
+    }
+    size_t size = input.size()/2;
+    vector<uint8_t> result(size);
+    const uint8_t* in = reinterpret_cast<const uint8_t*>(input.data());
+    for (size_t i = 0; i < size; i++) {
+        int8_t high = table[in[2*i]], low = table[in[2*i+1]];
+        if ((high|low) < 0)
+            throw OpenMMException("Illegal character in hex data");
+        result[i] = (high<<4) | low;
+    }
+    return result;
+}
+
+/**
+ * Encode an array of 32 bit values as base64.  The values are stored in little endian order,
+ * so the result does not depend on the platform.
+ */
+template <class T>
+static string encodeArray(const vector<T>& values) {
+    static_assert(sizeof(T) == 4, "Only 32 bit values are supported");
+    vector<uint8_t> bytes(4*values.size());
+    for (size_t i = 0; i < values.size(); i++) {
+        uint32_t v;
+        memcpy(&v, &values[i], 4);
+        bytes[4*i] = v&255;
+        bytes[4*i+1] = (v>>8)&255;
+        bytes[4*i+2] = (v>>16)&255;
+        bytes[4*i+3] = (v>>24)&255;
+    }
+    return base64Encode(bytes);
+}
+
+template <class T>
+static vector<T> decodeArray(const string& encoded) {
+    static_assert(sizeof(T) == 4, "Only 32 bit values are supported");
+    vector<uint8_t> bytes = base64Decode(encoded);
+    if (bytes.size()%4 != 0)
+        throw OpenMMException("Illegal length for encoded array");
+    vector<T> values(bytes.size()/4);
+    for (size_t i = 0; i < values.size(); i++) {
+        uint32_t v = bytes[4*i] | (bytes[4*i+1]<<8) | (bytes[4*i+2]<<16) | ((uint32_t) bytes[4*i+3]<<24);
+        memcpy(&values[i], &v, 4);
     }
-    return res;
+    return values;
+}
+
+static string computeHash(const vector<uint8_t>& data) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (uint8_t b : data) {
+        hash ^= b;
+        hash *= 1099511628211ULL;
+    }
+    stringstream ss;
+    ss<<hex<<setfill('0')<<setw(16)<<hash;
+    return ss.str();
 }
 
 OnnxForceProxy::OnnxForceProxy() : SerializationProxy("OnnxForce") {
 }
 
 void OnnxForceProxy::serialize(const void* object, SerializationNode& node) const {
-    node.setIntProperty("version", 1);
+    node.setIntProperty("version", 3);
     const OnnxForce& force = *reinterpret_cast<const OnnxForce*>(object);
-    node.setStringProperty("model", hexEncode(force.getModel()));
+    if (force.getSerializeModelAsReference()) {
+        node.setStringProperty("modelFile", force.getModelFile());
+        node.setStringProperty("modelHash", computeHash(force.getModel()));
+    }
+    else
+        node.setStringProperty("model", base64Encode(force.getModel()));
+    if (force.getEnergyOnlyModel().size() > 0)
+        node.setStringProperty("energyOnlyModel", base64Encode(force.getEnergyOnlyModel()));
     node.setIntProperty("forceGroup", force.getForceGroup());
     node.setBoolProperty("usesPeriodic", force.usesPeriodicBoundaryConditions());
-    const vector<int>& indices = force.getParticleIndices();
-    auto& indicesNode = node.createChildNode("ParticleIndices");
-    for (int i = 0; i < indices.size(); i++)
-        indicesNode.createChildNode("Particle").setIntProperty("index", indices[i]);
+    node.createChildNode("ParticleIndices").setStringProperty("values", encodeArray(force.getParticleIndices()));
     SerializationNode& inputs = node.createChildNode("Inputs");
     for (int i = 0; i < force.getNumInputs(); i++) {
         const OnnxForce::IntegerInput* integerInput = dynamic_cast<const OnnxForce::IntegerInput*>(&force.getInput(i));
-        if (integerInput != nullptr) {
-            SerializationNode& input = inputs.createChildNode("IntegerInput").setStringProperty("name", integerInput->getName());
-            SerializationNode& shape = input.createChildNode("Shape");
-            for (int j : integerInput->getShape())
-                shape.createChildNode("Dim").setIntProperty("d", j);
-            SerializationNode& values = input.createChildNode("Values");
-            for (int v : integerInput->getValues())
-                values.createChildNode("Value").setIntProperty("v", v);
-        }
+        if (integerInput != nullptr)
+            inputs.createChildNode("IntegerInput").setStringProperty("name", integerInput->getName())
+                    .setStringProperty("shape", encodeArray(integerInput->getShape()))
+                    .setStringProperty("values", encodeArray(integerInput->getValues()));
         const OnnxForce::FloatInput* floatInput = dynamic_cast<const OnnxForce::FloatInput*>(&force.getInput(i));
-        if (floatInput != nullptr) {
-            SerializationNode& input = inputs.createChildNode("FloatInput").setStringProperty("name", floatInput->getName());
-            SerializationNode& shape = input.createChildNode("Shape");
-            for (int j : floatInput->getShape())
-                shape.createChildNode("Dim").setIntProperty("d", j);
-            SerializationNode& values = input.createChildNode("Values");
-            for (float v : floatInput->getValues())
-                values.createChildNode("Value").setDoubleProperty("v", v);
-        }
+        if (floatInput != nullptr)
+            inputs.createChildNode("FloatInput").setStringProperty("name", floatInput->getName())
+                    .setStringProperty("shape", encodeArray(floatInput->getShape()))
+                    .setStringProperty("values", encodeArray(floatInput->getValues()));
     }
     SerializationNode& globalParams = node.createChildNode("GlobalParameters");
     for (int i = 0; i < force.getNumGlobalParameters(); i++)
         globalParams.createChildNode("Parameter").setStringProperty("name", force.getGlobalParameterName(i)).setDoubleProperty("default", force.getGlobalParameterDefaultValue(i));
+    SerializationNode& energyDerivs = node.createChildNode("EnergyParameterDerivatives");
+    for (int i = 0; i < force.getNumEnergyParameterDerivatives(); i++)
+        energyDerivs.createChildNode("Parameter").setStringProperty("name", force.getEnergyParameterDerivativeName(i));
+    SerializationNode& additionalModels = node.createChildNode("AdditionalModels");
+    for (int i = 0; i < force.getNumAdditionalModels(); i++)
+        additionalModels.createChildNode("Model").setStringProperty("model", base64Encode(force.getAdditionalModel(i)));
     SerializationNode& properties = node.createChildNode("Properties");
     for (auto& prop : force.getProperties())
         properties.createChildNode("Property").setStringProperty("name", prop.first).setStringProperty("value", prop.second);
@@ -107,41 +212,74 @@ void OnnxForceProxy::serialize(const void* object, SerializationNode& node) cons
 
 void* OnnxForceProxy::deserialize(const SerializationNode& node) const {
     int version = node.getIntProperty("version");
-    if (version != 1)
+    if (version < 1 || version > 3)
         throw OpenMMException("Unsupported version number");
-    OnnxForce* force = new OnnxForce(hexDecode(node.getStringProperty("model")));
+    OnnxForce* force;
+    if (version == 1)
+        force = new OnnxForce(hexDecode(node.getStringProperty("model")));
+    else if (node.hasProperty("modelFile")) {
+        const string& file = node.getStringProperty("modelFile");
+        force = new OnnxForce(file);
+        if (computeHash(force->getModel()) != node.getStringProperty("modelHash")) {
+            delete force;
+            throw OpenMMException("The model file "+file+" has changed since the OnnxForce was serialized");
+        }
+        force->setSerializeModelAsReference(true);
+    }
+    else
+        force = new OnnxForce(base64Decode(node.getStringProperty("model")));
+    if (node.hasProperty("energyOnlyModel"))
+        force->setEnergyOnlyModel(base64Decode(node.getStringProperty("energyOnlyModel")));
     force->setForceGroup(node.getIntProperty("forceGroup"));
     force->setUsesPeriodicBoundaryConditions(node.getBoolProperty("usesPeriodic"));
     for (const SerializationNode& child : node.getChildren()) {
+        // Before version 3, every array element was stored in its own node.
+
         if (child.getName() == "ParticleIndices") {
             vector<int> indices;
-            for (auto& particle : child.getChildren())
-                indices.push_back(particle.getIntProperty("index"));
+            if (version < 3)
+                for (auto& particle : child.getChildren())
+                    indices.push_back(particle.getIntProperty("index"));
+            else
+                indices = decodeArray<int>(child.getStringProperty("values"));
             force->setParticleIndices(indices);
         }
         if (child.getName() == "Inputs")
             for (auto& input : child.getChildren()) {
                 vector<int> shape;
-                const SerializationNode& shapeNode = input.getChildNode("Shape");
-                for (auto& dim : shapeNode.getChildren())
-                    shape.push_back(dim.getIntProperty("d"));
-                const SerializationNode& valuesNode = input.getChildNode("Values");
+                if (version < 3)
+                    for (auto& dim : input.getChildNode("Shape").getChildren())
+                        shape.push_back(dim.getIntProperty("d"));
+                else
+                    shape = decodeArray<int>(input.getStringProperty("shape"));
                 if (input.getName() == "IntegerInput") {
                     vector<int> values;
-                    for (auto& val : valuesNode.getChildren())
-                        values.push_back(val.getIntProperty("v"));
+                    if (version < 3)
+                        for (auto& val : input.getChildNode("Values").getChildren())
+                            values.push_back(val.getIntProperty("v"));
+                    else
+                        values = decodeArray<int>(input.getStringProperty("values"));
                     force->addInput(new OnnxForce::IntegerInput(input.getStringProperty("name"), values, shape));
                 }
                 if (input.getName() == "FloatInput") {
                     vector<float> values;
-                    for (auto& val : valuesNode.getChildren())
-                        values.push_back((float) val.getDoubleProperty("v"));
+                    if (version < 3)
+                        for (auto& val : input.getChildNode("Values").getChildren())
+                            values.push_back((float) val.getDoubleProperty("v"));
+                    else
+                        values = decodeArray<float>(input.getStringProperty("values"));
                     force->addInput(new OnnxForce::FloatInput(input.getStringProperty("name"), values, shape));
                 }
             }
         if (child.getName() == "GlobalParameters")
             for (auto& parameter : child.getChildren())
                 force->addGlobalParameter(parameter.getStringProperty("name"), parameter.getDoubleProperty("default"));
+        if (child.getName() == "EnergyParameterDerivatives")
+            for (auto& parameter : child.getChildren())
+                force->addEnergyParameterDerivative(parameter.getStringProperty("name"));
+        if (child.getName() == "AdditionalModels")
+            for (auto& model : child.getChildren())
+                force->addAdditionalModel(base64Decode(model.getStringProperty("model")));
         if (child.getName() == "Properties")
             for (auto& property : child.getChildren())
                 force->setProperty(property.getStringProperty("name"), property.getStringProperty("value"));
@@ -32,7 +32,10 @@
 #include "OnnxForce.h"
 #include "openmm/Platform.h"
 #include "openmm/internal/AssertionUtilities.h"
+#include "openmm/serialization/SerializationNode.h"
 #include "openmm/serialization/XmlSerializer.h"
+#include "OnnxForceProxy.h"
+#include <iomanip>
 #include <iostream>
 #include <sstream>
 
@@ -44,11 +47,16 @@ extern "C" void registerOnnxSerializationProxies();
 
 void testSerialization() {
     OnnxForce force("tests/central.onnx");
+    force.setEnergyOnlyModel("tests/energyonly.onnx");
+    force.addAdditionalModel("tests/global.onnx");
     force.setForceGroup(3);
     force.addGlobalParameter("x", 1.3);
     force.addGlobalParameter("y", 2.221);
+    force.addEnergyParameterDerivative("y");
     force.setUsesPeriodicBoundaryConditions(true);
     force.setProperty("UseGraphs", "true");
+    force.setProperty("TensorRTEngineCachePath", "engines");
+    force.setProperty("TensorRTPrecision", "fp16");
     force.setParticleIndices({0, 2, 4});
     force.addInput(new OnnxForce::IntegerInput("ints", {0, 1, 2, 3, 4, 5}, {2, 3}));
     force.addInput(new OnnxForce::FloatInput("floats", {2.0, 4.5, 5.3}, {1, 3}));
@@ -63,6 +71,10 @@ void testSerialization() {
 
     OnnxForce& force2 = *copy;
     ASSERT_EQUAL_CONTAINERS(force.getModel(), force2.getModel());
+    ASSERT_EQUAL_CONTAINERS(force.getEnergyOnlyModel(), force2.getEnergyOnlyModel());
+    ASSERT_EQUAL(force.getNumAdditionalModels(), force2.getNumAdditionalModels());
+    for (int i = 0; i < force.getNumAdditionalModels(); i++)
+        ASSERT_EQUAL_CONTAINERS(force.getAdditionalModel(i), force2.getAdditionalModel(i));
     ASSERT_EQUAL(force.getForceGroup(), force2.getForceGroup());
     ASSERT_EQUAL_CONTAINERS(force.getParticleIndices(), force2.getParticleIndices());
     ASSERT_EQUAL(force.getNumInputs(), force2.getNumInputs());
@@ -77,16 +89,85 @@ void testSerialization() {
         ASSERT_EQUAL(force.getGlobalParameterName(i), force2.getGlobalParameterName(i));
         ASSERT_EQUAL(force.getGlobalParameterDefaultValue(i), force2.getGlobalParameterDefaultValue(i));
     }
+    ASSERT_EQUAL(force.getNumEnergyParameterDerivatives(), force2.getNumEnergyParameterDerivatives());
+    for (int i = 0; i < force.getNumEnergyParameterDerivatives(); i++)
+        ASSERT_EQUAL(force.getEnergyParameterDerivativeName(i), force2.getEnergyParameterDerivativeName(i));
     ASSERT_EQUAL(force.usesPeriodicBoundaryConditions(), force2.usesPeriodicBoundaryConditions());
     ASSERT_EQUAL(force.getProperties().size(), force2.getProperties().size());
     for (auto& prop : force.getProperties())
         ASSERT_EQUAL(prop.second, force2.getProperties().at(prop.first));
 }
 
+void testModelReference() {
+    OnnxForce force("tests/central.onnx");
+    force.setSerializeModelAsReference(true);
+
+    // The serialized force should contain the path, not the model.
+
+    stringstream buffer;
+    XmlSerializer::serialize<OnnxForce>(&force, "Force", buffer);
+    ASSERT(buffer.str().find("tests/central.onnx") != string::npos);
+    ASSERT(buffer.str().size() < force.getModel().size());
+    OnnxForce* copy = XmlSerializer::deserialize<OnnxForce>(buffer);
+    ASSERT_EQUAL_CONTAINERS(force.getModel(), copy->getModel());
+    ASSERT(copy->getSerializeModelAsReference());
+    delete copy;
+
+    // A force created from a vector cannot be serialized as a reference.
+
+    OnnxForce force2(force.getModel());
+    bool threwException = false;
+    try {
+        force2.setSerializeModelAsReference(true);
+    }
+    catch (const OpenMMException& ex) {
+        threwException = true;
+    }
+    ASSERT(threwException);
+}
+
+void testVersion1() {
+    // Version 1 stored the model as a hex string.  Make sure it can still be read.
+
+    OnnxForce force("tests/central.onnx");
+    stringstream encoded;
+    encoded<<hex<<setfill('0');
+    for (uint8_t b : force.getModel())
+        encoded<<setw(2)<<(int) b;
+    SerializationNode node;
+    node.setIntProperty("version", 1);
+    node.setStringProperty("model", encoded.str());
+    node.setIntProperty("forceGroup", 2);
+    node.setBoolProperty("usesPeriodic", false);
+
+    // It also stored each array element in a separate node.
+
+    vector<int> indices = {1, 3, 5};
+    SerializationNode& indicesNode = node.createChildNode("ParticleIndices");
+    for (int i : indices)
+        indicesNode.createChildNode("Particle").setIntProperty("index", i);
+    SerializationNode& input = node.createChildNode("Inputs").createChildNode("FloatInput").setStringProperty("name", "floats");
+    input.createChildNode("Shape").createChildNode("Dim").setIntProperty("d", 2);
+    SerializationNode& values = input.createChildNode("Values");
+    values.createChildNode("Value").setDoubleProperty("v", 1.5);
+    values.createChildNode("Value").setDoubleProperty("v", -2.0);
+    OnnxForce* copy = reinterpret_cast<OnnxForce*>(OnnxForceProxy().deserialize(node));
+    ASSERT_EQUAL_CONTAINERS(force.getModel(), copy->getModel());
+    ASSERT_EQUAL(2, copy->getForceGroup());
+    ASSERT_EQUAL_CONTAINERS(indices, copy->getParticleIndices());
+    ASSERT_EQUAL(1, copy->getNumInputs());
+    ASSERT_EQUAL_CONTAINERS(vector<int>{2}, copy->getInput(0).getShape());
+    vector<float> expectedValues = {1.5, -2.0};
+    ASSERT_EQUAL_CONTAINERS(expectedValues, dynamic_cast<OnnxForce::FloatInput&>(copy->getInput(0)).getValues());
+    delete copy;
+}
+
 int main() {
     try {
         registerOnnxSerializationProxies();
         testSerialization();
+        testModelReference();
+        testVersion1();
     }
     catch(const exception& e) {
         cout << "exception: " << e.what() << endl;
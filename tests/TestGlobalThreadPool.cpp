@@ -0,0 +1,164 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2025 Stanford University and the Authors.           *
+ * Authors: Peter Eastman                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+
+/**
+ * This tests the GlobalThreadPool property.  The global thread pools belong to the process wide ONNX Runtime
+ * environment, which is created along with the first session, so this must run in its own executable.
+ */
+
+#include "OnnxForce.h"
+#include "openmm/internal/AssertionUtilities.h"
+#include "openmm/Context.h"
+#include "openmm/Platform.h"
+#include "openmm/System.h"
+#include "openmm/VerletIntegrator.h"
+#include "sfmt/SFMT.h"
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+#ifdef __linux__
+#include <dirent.h>
+#endif
+
+using namespace OnnxPlugin;
+using namespace OpenMM;
+using namespace std;
+
+int countThreads() {
+    // Return the number of threads in this process, or -1 if that is not available on this operating system.
+
+    int count = -1;
+#ifdef __linux__
+    DIR* dir = opendir("/proc/self/task");
+    if (dir != nullptr) {
+        count = 0;
+        while (dirent* entry = readdir(dir))
+            if (entry->d_name[0] != '.')
+                count++;
+        closedir(dir);
+    }
+#endif
+    return count;
+}
+
+void testGlobalThreadPool(Platform& platform) {
+    // Create a random cloud of particles.
+
+    const int numParticles = 10;
+    System system;
+    vector<Vec3> positions(numParticles);
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    for (int i = 0; i < numParticles; i++) {
+        system.addParticle(1.0);
+        positions[i] = Vec3(genrand_real2(sfmt), genrand_real2(sfmt), genrand_real2(sfmt))*10;
+    }
+    map<string, string> properties = {{"GlobalThreadPool", "true"}, {"IntraOpThreads", "4"}, {"InterOpThreads", "1"}};
+    OnnxForce* force = new OnnxForce("tests/central.onnx", properties);
+    force->setExecutionProvider(OnnxForce::CPU);
+    system.addForce(force);
+
+    // Create Contexts whose sessions have different optimization levels, so they cannot be shared.  They
+    // should all compute the correct forces.
+
+    vector<VerletIntegrator*> integrators;
+    vector<Context*> contexts;
+    vector<int> threadCounts;
+    for (string level : {"all", "extended", "basic", "disabled"}) {
+        force->setProperty("GraphOptimizationLevel", level);
+        integrators.push_back(new VerletIntegrator(1.0));
+        contexts.push_back(new Context(system, *integrators.back(), platform));
+        contexts.back()->setPositions(positions);
+        State state = contexts.back()->getState(State::Forces);
+        for (int i = 0; i < numParticles; i++)
+            ASSERT_EQUAL_VEC(positions[i]*(-2.0), state.getForces()[i], 1e-5);
+        threadCounts.push_back(countThreads());
+    }
+
+    // The sessions should not create their own threads, so the number of threads should not have grown
+    // after the first one created the global pools.
+
+    for (int count : threadCounts)
+        ASSERT_EQUAL(threadCounts[0], count);
+
+    // Requesting different settings for the global pools should produce an exception.
+
+    force->setProperty("GraphOptimizationLevel", "all");
+    for (auto property : vector<pair<string, string> >{{"IntraOpThreads", "2"}, {"InterOpThreads", "2"}, {"AllowSpinning", "false"}}) {
+        force->setProperty("IntraOpThreads", "4");
+        force->setProperty("InterOpThreads", "1");
+        force->setProperty("AllowSpinning", "auto");
+        force->setProperty(property.first, property.second);
+        bool threwException = false;
+        try {
+            VerletIntegrator integ(1.0);
+            Context context(system, integ, platform);
+        }
+        catch (const OpenMMException& ex) {
+            threwException = true;
+        }
+        ASSERT(threwException);
+    }
+
+    // Forces that do not use the global pools can still create their own threads.
+
+    force->setProperty("AllowSpinning", "auto");
+    force->setProperty("GlobalThreadPool", "false");
+    {
+        VerletIntegrator integ(1.0);
+        Context context(system, integ, platform);
+        context.setPositions(positions);
+        State state = context.getState(State::Forces);
+        for (int i = 0; i < numParticles; i++)
+            ASSERT_EQUAL_VEC(positions[i]*(-2.0), state.getForces()[i], 1e-5);
+    }
+    for (int i = 0; i < contexts.size(); i++) {
+        delete contexts[i];
+        delete integrators[i];
+    }
+}
+
+int main(int argc, char* argv[]) {
+    try {
+        // The Reference platform does not create threads of its own, which would interfere with counting them.
+
+        Platform::loadPluginsFromDirectory(Platform::getDefaultPluginsDirectory());
+        testGlobalThreadPool(Platform::getPlatformByName("Reference"));
+    }
+    catch(const std::exception& e) {
+        std::cout << "exception: " << e.what() << std::endl;
+        return 1;
+    }
+    std::cout << "Done" << std::endl;
+    return 0;
+}
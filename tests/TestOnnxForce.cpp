@@ -38,14 +38,29 @@
 #include "sfmt/SFMT.h"
 #include <algorithm>
 #include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
+#include <random>
+#include <string>
+#include <thread>
 #include <vector>
+#ifdef _WIN32
+#include <direct.h>
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 using namespace OnnxPlugin;
 using namespace OpenMM;
 using namespace std;
 
-void testForce(Platform& platform, vector<int> particleIndices) {
+void testForce(Platform& platform, vector<int> particleIndices, int conversionThreads=1) {
     // Create a random cloud of particles.
 
     const int numParticles = 10;
@@ -59,6 +74,7 @@ void testForce(Platform& platform, vector<int> particleIndices) {
     }
     OnnxForce* force = new OnnxForce("tests/central.onnx");
     force->setParticleIndices(particleIndices);
+    force->setProperty("ConversionThreads", to_string(conversionThreads));
     if (particleIndices.size() == 0)
         for (int i = 0; i < numParticles; i++)
             particleIndices.push_back(i);
@@ -126,6 +142,21 @@ void testPeriodicForce(Platform& platform) {
         ASSERT_EQUAL_VEC(pos*(-2.0), state.getForces()[i], 1e-5);
     }
     ASSERT_EQUAL_TOL(expectedEnergy, state.getPotentialEnergy(), 1e-5);
+
+    // Change only the box vectors and make sure the results are updated.
+
+    context.setPeriodicBoxVectors(Vec3(2.5, 0, 0), Vec3(0, 3, 0), Vec3(0, 0, 4));
+    state = context.getState(State::Energy | State::Forces);
+    expectedEnergy = 0;
+    for (int i = 0; i < numParticles; i++) {
+        Vec3 pos = positions[i];
+        pos[0] -= floor(pos[0]/2.5)*2.5;
+        pos[1] -= floor(pos[1]/3.0)*3.0;
+        pos[2] -= floor(pos[2]/4.0)*4.0;
+        expectedEnergy += pos.dot(pos);
+        ASSERT_EQUAL_VEC(pos*(-2.0), state.getForces()[i], 1e-5);
+    }
+    ASSERT_EQUAL_TOL(expectedEnergy, state.getPotentialEnergy(), 1e-5);
 }
 
 void testGlobal(Platform& platform) {
@@ -172,6 +203,151 @@ void testGlobal(Platform& platform) {
         ASSERT_EQUAL_VEC(pos*(-6.0), state.getForces()[i], 1e-5);
     }
     ASSERT_EQUAL_TOL(expectedEnergy*1.5, state.getPotentialEnergy(), 1e-5);
+
+    // Move the particles without changing the parameter, then change it back.  The parameter tensor
+    // is only updated when the value changes, so this checks that the old value is still used in
+    // between.
+
+    for (int i = 0; i < numParticles; i++)
+        positions[i] = positions[i]*0.5;
+    context.setPositions(positions);
+    state = context.getState(State::Forces);
+    for (int i = 0; i < numParticles; i++)
+        ASSERT_EQUAL_VEC(positions[i]*(-6.0), state.getForces()[i], 1e-5);
+    context.setParameter("k", 2.0);
+    state = context.getState(State::Forces);
+    for (int i = 0; i < numParticles; i++)
+        ASSERT_EQUAL_VEC(positions[i]*(-4.0), state.getForces()[i], 1e-5);
+}
+
+void testParameterDerivatives(Platform& platform) {
+    // The model computes E = k*sum(r^2), and returns dE/dk as an extra output.
+
+    const int numParticles = 5;
+    System system;
+    vector<Vec3> positions;
+    for (int i = 0; i < numParticles; i++) {
+        system.addParticle(1.0);
+        positions.push_back(Vec3(i, 0.5*i, -0.2*i));
+    }
+    OnnxForce* force = new OnnxForce("tests/derivatives.onnx");
+    force->addGlobalParameter("k", 2.0);
+    force->addEnergyParameterDerivative("k");
+    system.addForce(force);
+    VerletIntegrator integ(1.0);
+    Context context(system, integ, platform);
+    context.setPositions(positions);
+    double sumr2 = 0;
+    for (int i = 0; i < numParticles; i++)
+        sumr2 += positions[i].dot(positions[i]);
+    for (double k : {2.0, 3.5}) {
+        context.setParameter("k", k);
+        State state = context.getState(State::Energy | State::Forces);
+        ASSERT_EQUAL_TOL(k*sumr2, state.getPotentialEnergy(), 1e-5);
+        map<string, double> derivs = force->getEnergyParameterDerivatives(context);
+        ASSERT_EQUAL(1, derivs.size());
+        ASSERT_EQUAL_TOL(sumr2, derivs["k"], 1e-5);
+    }
+
+    // Requesting a derivative with respect to a parameter that does not exist should fail.
+
+    System system2;
+    for (int i = 0; i < numParticles; i++)
+        system2.addParticle(1.0);
+    OnnxForce* force2 = new OnnxForce("tests/derivatives.onnx");
+    force2->addGlobalParameter("k", 2.0);
+    force2->addEnergyParameterDerivative("x");
+    system2.addForce(force2);
+    VerletIntegrator integ2(1.0);
+    bool threwException = false;
+    try {
+        Context context2(system2, integ2, platform);
+    }
+    catch (const OpenMMException& ex) {
+        threwException = true;
+    }
+    ASSERT(threwException);
+}
+
+void testEnergyConservation(Platform& platform) {
+    // Simulate a set of harmonic oscillators at constant energy.  This checks that the forces are consistent
+    // with the energy, and that they are accurate enough to conserve energy.
+
+    const int numParticles = 10;
+    System system;
+    vector<Vec3> positions(numParticles);
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    for (int i = 0; i < numParticles; i++) {
+        system.addParticle(1.0);
+        positions[i] = Vec3(genrand_real2(sfmt), genrand_real2(sfmt), genrand_real2(sfmt));
+    }
+    system.addForce(new OnnxForce("tests/central.onnx"));
+    VerletIntegrator integ(0.001);
+    Context context(system, integ, platform);
+    context.setPositions(positions);
+    context.setVelocitiesToTemperature(300.0);
+    State state = context.getState(State::Energy);
+    double initialEnergy = state.getPotentialEnergy()+state.getKineticEnergy();
+    for (int i = 0; i < 10; i++) {
+        integ.step(100);
+        state = context.getState(State::Energy);
+        ASSERT_EQUAL_TOL(initialEnergy, state.getPotentialEnergy()+state.getKineticEnergy(), 1e-3);
+    }
+}
+
+void testEvaluationInterval(Platform& platform) {
+    const int numParticles = 10;
+    System system;
+    vector<Vec3> positions(numParticles);
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    for (int i = 0; i < numParticles; i++) {
+        system.addParticle(1.0);
+        positions[i] = Vec3(genrand_real2(sfmt), genrand_real2(sfmt), genrand_real2(sfmt));
+    }
+    OnnxForce* force = new OnnxForce("tests/central.onnx");
+    force->setProperty("EvaluationInterval", "3");
+    system.addForce(force);
+    VerletIntegrator integ(0.001);
+    Context context(system, integ, platform);
+    context.setPositions(positions);
+
+    // On the first step, the force should be applied with three times its normal magnitude.
+
+    ASSERT(force->isEvaluationStep(context));
+    State state = context.getState(State::Forces);
+    for (int i = 0; i < numParticles; i++)
+        ASSERT_EQUAL_VEC(positions[i]*(-6.0), state.getForces()[i], 1e-5);
+
+    // On the next step no force should be applied, but the energy should still be correct.
+
+    integ.step(1);
+    ASSERT(!force->isEvaluationStep(context));
+    state = context.getState(State::Forces | State::Energy | State::Positions);
+    double expectedEnergy = 0;
+    for (int i = 0; i < numParticles; i++) {
+        ASSERT_EQUAL_VEC(Vec3(), state.getForces()[i], 1e-5);
+        expectedEnergy += state.getPositions()[i].dot(state.getPositions()[i]);
+    }
+    ASSERT_EQUAL_TOL(expectedEnergy, state.getPotentialEnergy(), 1e-5);
+
+    // The trajectory should be close to one computed by evaluating the force on every step.
+
+    System system2;
+    for (int i = 0; i < numParticles; i++)
+        system2.addParticle(1.0);
+    system2.addForce(new OnnxForce("tests/central.onnx"));
+    VerletIntegrator integ2(0.001);
+    Context context2(system2, integ2, platform);
+    context2.setPositions(positions);
+    integ2.step(1);
+    integ.step(299);
+    integ2.step(299);
+    State state2 = context2.getState(State::Positions);
+    state = context.getState(State::Positions);
+    for (int i = 0; i < numParticles; i++)
+        ASSERT_EQUAL_VEC(state2.getPositions()[i], state.getPositions()[i], 1e-2);
 }
 
 void testInputs(Platform& platform) {
@@ -213,14 +389,900 @@ void testInputs(Platform& platform) {
         ASSERT_EQUAL_VEC(pos*(-2.0*scale[i]), state.getForces()[i], 1e-5);
     }
     ASSERT_EQUAL_TOL(expectedEnergy, state.getPotentialEnergy(), 1e-5);
+
+    // Modify the inputs and update the Context.
+
+    for (int i = 0; i < numParticles; i++) {
+        scale[i] = 2*i+1;
+        offset[i] = -0.5*i;
+    }
+    dynamic_cast<OnnxForce::IntegerInput&>(force->getInput(0)).setValues(scale);
+    dynamic_cast<OnnxForce::FloatInput&>(force->getInput(1)).setValues(offset);
+    force->updateInputsInContext(context);
+    state = context.getState(State::Energy | State::Forces);
+    expectedEnergy = 0;
+    for (int i = 0; i < numParticles; i++) {
+        Vec3 pos = positions[i];
+        expectedEnergy += scale[i]*(pos.dot(pos)-offset[i]);
+        ASSERT_EQUAL_VEC(pos*(-2.0*scale[i]), state.getForces()[i], 1e-5);
+    }
+    ASSERT_EQUAL_TOL(expectedEnergy, state.getPotentialEnergy(), 1e-5);
+
+    // Changing the shape of an input is not allowed.
+
+    force->getInput(1).setShape({2, 5});
+    bool threwException = false;
+    try {
+        force->updateInputsInContext(context);
+    }
+    catch (const OpenMMException& ex) {
+        threwException = true;
+    }
+    ASSERT(threwException);
+}
+
+void testUpdateParticleIndices(Platform& platform) {
+    // Create a force that is applied to a subset of particles, with a per-particle input.
+
+    const int numParticles = 10;
+    System system;
+    vector<Vec3> positions(numParticles);
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    for (int i = 0; i < numParticles; i++) {
+        system.addParticle(1.0);
+        positions[i] = Vec3(genrand_real2(sfmt), genrand_real2(sfmt), genrand_real2(sfmt))*10;
+    }
+    OnnxForce* force = new OnnxForce("tests/inputs.onnx");
+    system.addForce(force);
+    force->addInput(new OnnxForce::IntegerInput("scale", {1, 2, 3}, {3}));
+    force->addInput(new OnnxForce::FloatInput("offset", {0.0, 0.0, 0.0}, {3}));
+    force->setParticleIndices({0, 1, 2});
+    VerletIntegrator integ(1.0);
+    Context context(system, integ, platform);
+    context.setPositions(positions);
+
+    // Change the subset several times, growing and shrinking it, and check the forces each time.
+
+    vector<vector<int> > subsets = {{0, 1, 2}, {2, 3, 5, 7, 8, 9}, {4}, {0, 1, 2, 3, 4, 5, 6, 7, 8, 9}};
+    for (const vector<int>& indices : subsets) {
+        int size = indices.size();
+        vector<int> scale(size);
+        for (int i = 0; i < size; i++)
+            scale[i] = i+1;
+        force->setParticleIndices(indices);
+        force->getInput(0).setShape({size});
+        force->getInput(1).setShape({size});
+        dynamic_cast<OnnxForce::IntegerInput&>(force->getInput(0)).setValues(scale);
+        dynamic_cast<OnnxForce::FloatInput&>(force->getInput(1)).setValues(vector<float>(size, 0.0));
+        force->updateParticleIndicesInContext(context);
+        State state = context.getState(State::Energy | State::Forces);
+        double expectedEnergy = 0;
+        vector<Vec3> expectedForces(numParticles);
+        for (int i = 0; i < size; i++) {
+            Vec3 pos = positions[indices[i]];
+            expectedEnergy += scale[i]*pos.dot(pos);
+            expectedForces[indices[i]] = pos*(-2.0*scale[i]);
+        }
+        ASSERT_EQUAL_TOL(expectedEnergy, state.getPotentialEnergy(), 1e-5);
+        for (int i = 0; i < numParticles; i++)
+            ASSERT_EQUAL_VEC(expectedForces[i], state.getForces()[i], 1e-5);
+    }
+}
+
+void testDoublePrecision(Platform& platform) {
+    // Create a random cloud of particles.
+
+    const int numParticles = 10;
+    System system;
+    vector<Vec3> positions(numParticles);
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    for (int i = 0; i < numParticles; i++) {
+        system.addParticle(1.0);
+        positions[i] = Vec3(genrand_real2(sfmt), genrand_real2(sfmt), genrand_real2(sfmt))*10;
+    }
+
+    // This model uses float64 for positions, parameters, and outputs, and int64 for its extra input.
+
+    OnnxForce* force = new OnnxForce("tests/double.onnx");
+    force->addGlobalParameter("k", 1.5);
+    vector<int> scale = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9};
+    force->addInput(new OnnxForce::IntegerInput("scale", scale, {10}));
+    system.addForce(force);
+
+    // Compute the forces and energy.
+
+    VerletIntegrator integ(1.0);
+    Context context(system, integ, platform);
+    context.setPositions(positions);
+    State state = context.getState(State::Energy | State::Forces);
+
+    // See if the energy is correct.  The network defines a potential of the form E(r) = k*scale*|r|^2.
+    // Since everything is computed in double precision, the results should be very accurate.
+
+    double expectedEnergy = 0;
+    for (int i = 0; i < numParticles; i++) {
+        Vec3 pos = positions[i];
+        expectedEnergy += 1.5*scale[i]*pos.dot(pos);
+        ASSERT_EQUAL_VEC(pos*(-3.0*scale[i]), state.getForces()[i], 1e-10);
+    }
+    ASSERT_EQUAL_TOL(expectedEnergy, state.getPotentialEnergy(), 1e-10);
+
+    // A FloatInput cannot be passed to an integer input.
+
+    System system2;
+    for (int i = 0; i < numParticles; i++)
+        system2.addParticle(1.0);
+    OnnxForce* force2 = new OnnxForce("tests/double.onnx");
+    force2->addGlobalParameter("k", 1.5);
+    force2->addInput(new OnnxForce::FloatInput("scale", vector<float>(numParticles, 1.0f), {10}));
+    system2.addForce(force2);
+    VerletIntegrator integ2(1.0);
+    bool threwException = false;
+    try {
+        Context context2(system2, integ2, platform);
+    }
+    catch (const OpenMMException& ex) {
+        threwException = true;
+    }
+    ASSERT(threwException);
+}
+
+void testSharedModel(Platform& platform) {
+    // Forces that load the same file should share a single copy of the model.
+
+    OnnxForce force1("tests/central.onnx");
+    OnnxForce force2("tests/central.onnx");
+    ASSERT(&force1.getModel() == &force2.getModel());
+
+    // A force created from a vector has its own copy.
+
+    OnnxForce force3(force1.getModel());
+    ASSERT(&force1.getModel() != &force3.getModel());
+    ASSERT_EQUAL_CONTAINERS(force1.getModel(), force3.getModel());
+
+    // Forces created either way should produce the same results.
+
+    const int numParticles = 5;
+    vector<Vec3> positions;
+    for (int i = 0; i < numParticles; i++)
+        positions.push_back(Vec3(i, 0.5*i, -0.2*i));
+    for (int i = 0; i < 2; i++) {
+        System system;
+        for (int j = 0; j < numParticles; j++)
+            system.addParticle(1.0);
+        system.addForce(i == 0 ? new OnnxForce("tests/central.onnx") : new OnnxForce(force1.getModel()));
+        VerletIntegrator integ(1.0);
+        Context context(system, integ, platform);
+        context.setPositions(positions);
+        State state = context.getState(State::Forces);
+        for (int j = 0; j < numParticles; j++)
+            ASSERT_EQUAL_VEC(positions[j]*(-2.0), state.getForces()[j], 1e-5);
+    }
+}
+
+void testNeighborList(Platform& platform, bool periodic, bool triclinic) {
+    // Create a random cloud of particles.  The triclinic box is tilted enough that the distance between
+    // opposite faces is much less than the diagonal elements of the box vectors.
+
+    const int numParticles = (triclinic ? 300 : 100);
+    const double boxSize = 3.0;
+    Vec3 box[3] = {Vec3(boxSize, 0, 0), Vec3(0, boxSize, 0), Vec3(0, 0, boxSize)};
+    if (triclinic) {
+        box[0] = Vec3(4.8, 0, 0);
+        box[1] = Vec3(2.4, 4.8, 0);
+        box[2] = Vec3(2.4, 2.4, 2.45);
+    }
+    System system;
+    system.setDefaultPeriodicBoxVectors(box[0], box[1], box[2]);
+    vector<Vec3> positions(numParticles);
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    for (int i = 0; i < numParticles; i++) {
+        system.addParticle(1.0);
+        positions[i] = box[0]*genrand_real2(sfmt) + box[1]*genrand_real2(sfmt) + box[2]*genrand_real2(sfmt);
+    }
+
+    // The model computes E = sum of r^2 over all pairs with r < 1, using the neighbor list provided by the plugin.
+
+    OnnxForce* force = new OnnxForce("tests/neighbors.onnx");
+    force->setUsesPeriodicBoundaryConditions(periodic);
+    force->setProperty("NeighborCutoff", "1.0");
+    force->setProperty("NeighborSkin", "0.2");
+    system.addForce(force);
+    VerletIntegrator integ(1.0);
+    Context context(system, integ, platform);
+
+    // Move the particles by different amounts.  Small moves should reuse the list, while large ones
+    // cause it to be rebuilt.  Either way, the results should match a direct calculation.
+
+    for (int step = 0; step < 6; step++) {
+        double scale = (step < 3 ? 0.01 : 0.3);
+        for (int i = 0; i < numParticles; i++)
+            positions[i] += Vec3(genrand_real2(sfmt)-0.5, genrand_real2(sfmt)-0.5, genrand_real2(sfmt)-0.5)*scale;
+        context.setPositions(positions);
+        State state = context.getState(State::Energy | State::Forces);
+        double expectedEnergy = 0;
+        vector<Vec3> expectedForces(numParticles);
+        for (int i = 0; i < numParticles; i++)
+            for (int j = i+1; j < numParticles; j++) {
+                Vec3 delta = positions[j]-positions[i];
+                if (periodic) {
+                    // Find the nearest periodic image by brute force.
+
+                    delta -= box[2]*round(delta[2]/box[2][2]);
+                    delta -= box[1]*round(delta[1]/box[1][1]);
+                    delta -= box[0]*round(delta[0]/box[0][0]);
+                    Vec3 nearest = delta;
+                    for (int x = -1; x <= 1; x++)
+                        for (int y = -1; y <= 1; y++)
+                            for (int z = -1; z <= 1; z++) {
+                                Vec3 image = delta + box[0]*x + box[1]*y + box[2]*z;
+                                if (image.dot(image) < nearest.dot(nearest))
+                                    nearest = image;
+                            }
+                    delta = nearest;
+                }
+                double r2 = delta.dot(delta);
+                if (r2 < 1.0) {
+                    expectedEnergy += r2;
+                    expectedForces[i] += delta*2.0;
+                    expectedForces[j] -= delta*2.0;
+                }
+            }
+        ASSERT_EQUAL_TOL(expectedEnergy, state.getPotentialEnergy(), 1e-4);
+        for (int i = 0; i < numParticles; i++)
+            ASSERT_EQUAL_VEC(expectedForces[i], state.getForces()[i], 1e-4);
+    }
+}
+
+void testDomainDecomposition(Platform& platform, bool periodic) {
+    // Create a random cloud of particles.
+
+    const int numParticles = 60;
+    const double boxSize = 4.0;
+    System system;
+    system.setDefaultPeriodicBoxVectors(Vec3(boxSize, 0, 0), Vec3(0, boxSize, 0), Vec3(0, 0, boxSize));
+    vector<Vec3> positions(numParticles);
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    for (int i = 0; i < numParticles; i++) {
+        system.addParticle(1.0);
+        positions[i] = Vec3(genrand_real2(sfmt), genrand_real2(sfmt), genrand_real2(sfmt))*boxSize;
+    }
+
+    // The model computes E = 0.5*sum of (1-r^2)^2 over all ordered pairs with r < 1, including each particle
+    // with itself, counting only pairs whose first particle is owned by the domain.  Divide it between four
+    // sessions on the CPU.
+
+    OnnxForce* force = new OnnxForce(periodic ? "tests/domainsperiodic.onnx" : "tests/domains.onnx");
+    force->setExecutionProvider(OnnxForce::CPU);
+    force->setUsesPeriodicBoundaryConditions(periodic);
+    force->setProperty("DeviceIndex", "0,1,2,3");
+    force->setProperty("DomainHaloWidth", "1.0");
+    system.addForce(force);
+    VerletIntegrator integ(1.0);
+    Context context(system, integ, platform);
+    context.setPositions(positions);
+    State state = context.getState(State::Energy | State::Forces);
+
+    // The results should match a direct calculation.
+
+    double expectedEnergy = 0;
+    vector<Vec3> expectedForces(numParticles);
+    for (int i = 0; i < numParticles; i++)
+        for (int j = 0; j < numParticles; j++) {
+            Vec3 delta = positions[i]-positions[j];
+            if (periodic)
+                for (int k = 0; k < 3; k++)
+                    delta[k] -= boxSize*round(delta[k]/boxSize);
+            double r2 = delta.dot(delta);
+            if (r2 < 1.0) {
+                expectedEnergy += 0.5*(1-r2)*(1-r2);
+                expectedForces[i] += delta*4.0*(1-r2);
+            }
+        }
+    ASSERT_EQUAL_TOL(expectedEnergy, state.getPotentialEnergy(), 1e-4);
+    for (int i = 0; i < numParticles; i++)
+        ASSERT_EQUAL_VEC(expectedForces[i], state.getForces()[i], 1e-4);
+
+    // Multiple devices require a halo width.
+
+    System system2;
+    for (int i = 0; i < numParticles; i++)
+        system2.addParticle(1.0);
+    OnnxForce* force2 = new OnnxForce("tests/domains.onnx");
+    force2->setExecutionProvider(OnnxForce::CPU);
+    force2->setProperty("DeviceIndex", "0,1");
+    system2.addForce(force2);
+    VerletIntegrator integ2(1.0);
+    bool threwException = false;
+    try {
+        Context context2(system2, integ2, platform);
+    }
+    catch (const OpenMMException& ex) {
+        threwException = true;
+    }
+    ASSERT(threwException);
+}
+
+void testEnergyOnlyModel(Platform& platform) {
+    // The energy-only model returns twice the energy of the main model, so we can tell which one was used.
+
+    const int numParticles = 5;
+    System system;
+    vector<Vec3> positions;
+    for (int i = 0; i < numParticles; i++) {
+        system.addParticle(1.0);
+        positions.push_back(Vec3(i, 0.5*i, -0.2*i));
+    }
+    OnnxForce* force = new OnnxForce("tests/central.onnx");
+    force->setEnergyOnlyModel("tests/energyonly.onnx");
+    system.addForce(force);
+    VerletIntegrator integ(1.0);
+    Context context(system, integ, platform);
+    context.setPositions(positions);
+    double expectedEnergy = 0;
+    for (int i = 0; i < numParticles; i++)
+        expectedEnergy += positions[i].dot(positions[i]);
+
+    // Requesting only the energy should use the energy-only model.
+
+    State state1 = context.getState(State::Energy);
+    ASSERT_EQUAL_TOL(2*expectedEnergy, state1.getPotentialEnergy(), 1e-5);
+
+    // Requesting forces should use the main model, even though the positions have not changed.
+
+    State state2 = context.getState(State::Energy | State::Forces);
+    ASSERT_EQUAL_TOL(expectedEnergy, state2.getPotentialEnergy(), 1e-5);
+    for (int i = 0; i < numParticles; i++)
+        ASSERT_EQUAL_VEC(positions[i]*(-2.0), state2.getForces()[i], 1e-5);
+
+    // The energy from the main model is still valid, so it should be reused.
+
+    State state3 = context.getState(State::Energy);
+    ASSERT_EQUAL_TOL(expectedEnergy, state3.getPotentialEnergy(), 1e-5);
+
+    // An energy-only model whose inputs do not match the main model should be rejected.
+
+    System system2;
+    for (int i = 0; i < numParticles; i++)
+        system2.addParticle(1.0);
+    OnnxForce* force2 = new OnnxForce("tests/central.onnx");
+    force2->setEnergyOnlyModel("tests/double.onnx");
+    system2.addForce(force2);
+    VerletIntegrator integ2(1.0);
+    bool threwException = false;
+    try {
+        Context context2(system2, integ2, platform);
+    }
+    catch (const OpenMMException& ex) {
+        threwException = true;
+    }
+    ASSERT(threwException);
+}
+
+void testAdditionalModels(Platform& platform) {
+    // The main model computes k*|r|^2 and the additional model computes |r|^2, so the total is (k+1)*|r|^2.
+    // The force is only applied to some particles, to check that the forces are added to the right ones.
+
+    const int numParticles = 8;
+    System system;
+    vector<Vec3> positions;
+    for (int i = 0; i < numParticles; i++) {
+        system.addParticle(1.0);
+        positions.push_back(Vec3(i, 0.5*i, -0.2*i));
+    }
+    vector<int> particleIndices = {1, 3, 4, 7};
+    OnnxForce* force = new OnnxForce("tests/global.onnx");
+    force->addGlobalParameter("k", 2.0);
+    force->setParticleIndices(particleIndices);
+    ASSERT_EQUAL(0, force->addAdditionalModel("tests/central.onnx"));
+    ASSERT_EQUAL(1, force->getNumAdditionalModels());
+    system.addForce(force);
+    VerletIntegrator integ(1.0);
+    Context context(system, integ, platform);
+    context.setPositions(positions);
+    for (double k : {2.0, 5.0}) {
+        context.setParameter("k", k);
+        State state = context.getState(State::Energy | State::Forces);
+        double expectedEnergy = 0;
+        vector<Vec3> expectedForces(numParticles);
+        for (int i : particleIndices) {
+            expectedEnergy += (k+1)*positions[i].dot(positions[i]);
+            expectedForces[i] = positions[i]*(-2*(k+1));
+        }
+        ASSERT_EQUAL_TOL(expectedEnergy, state.getPotentialEnergy(), 1e-5);
+        for (int i = 0; i < numParticles; i++)
+            ASSERT_EQUAL_VEC(expectedForces[i], state.getForces()[i], 1e-5);
+    }
+
+    // An additional model that takes inputs which are not passed to the main model should be rejected.
+
+    for (string file : {"tests/global.onnx", "tests/double.onnx"}) {
+        System system2;
+        for (int i = 0; i < numParticles; i++)
+            system2.addParticle(1.0);
+        OnnxForce* force2 = new OnnxForce("tests/central.onnx");
+        force2->addAdditionalModel(file);
+        system2.addForce(force2);
+        VerletIntegrator integ2(1.0);
+        bool threwException = false;
+        try {
+            Context context2(system2, integ2, platform);
+        }
+        catch (const OpenMMException& ex) {
+            threwException = true;
+        }
+        ASSERT(threwException);
+    }
+}
+
+void testMultipleContexts(Platform& platform) {
+    // Create a random cloud of particles.
+
+    const int numParticles = 10;
+    System system;
+    vector<Vec3> positions1(numParticles), positions2(numParticles);
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    for (int i = 0; i < numParticles; i++) {
+        system.addParticle(1.0);
+        positions1[i] = Vec3(genrand_real2(sfmt), genrand_real2(sfmt), genrand_real2(sfmt))*10;
+        positions2[i] = Vec3(genrand_real2(sfmt), genrand_real2(sfmt), genrand_real2(sfmt))*10;
+    }
+    OnnxForce* force = new OnnxForce("tests/central.onnx");
+    system.addForce(force);
+
+    // Create two Contexts that share a session, and make sure they each compute the correct forces.
+
+    VerletIntegrator integ1(1.0), integ2(1.0);
+    Context* context1 = new Context(system, integ1, platform);
+    Context context2(system, integ2, platform);
+    context1->setPositions(positions1);
+    context2.setPositions(positions2);
+    for (int repeat = 0; repeat < 2; repeat++) {
+        State state1 = context1->getState(State::Forces);
+        State state2 = context2.getState(State::Forces);
+        for (int i = 0; i < numParticles; i++) {
+            ASSERT_EQUAL_VEC(positions1[i]*(-2.0), state1.getForces()[i], 1e-5);
+            ASSERT_EQUAL_VEC(positions2[i]*(-2.0), state2.getForces()[i], 1e-5);
+        }
+    }
+    ASSERT_EQUAL(0, force->getTimingStatistics(*context1)["sharedSession"]);
+    ASSERT_EQUAL(1, force->getTimingStatistics(context2)["sharedSession"]);
+
+    // Properties that do not affect the session should not prevent sharing it, but ones that do should.
+
+    force->setProperty("EnableTiming", "true");
+    {
+        VerletIntegrator integ3(1.0);
+        Context context3(system, integ3, platform);
+        ASSERT_EQUAL(1, force->getTimingStatistics(context3)["sharedSession"]);
+    }
+    force->setProperty("EnableTiming", "false");
+    force->setProperty("GraphOptimizationLevel", "basic");
+    {
+        VerletIntegrator integ3(1.0);
+        Context context3(system, integ3, platform);
+        ASSERT_EQUAL(0, force->getTimingStatistics(context3)["sharedSession"]);
+    }
+    force->setProperty("GraphOptimizationLevel", "all");
+
+    // Deleting one Context should not affect the other one.
+
+    delete context1;
+    State state2 = context2.getState(State::Forces);
+    for (int i = 0; i < numParticles; i++)
+        ASSERT_EQUAL_VEC(positions2[i]*(-2.0), state2.getForces()[i], 1e-5);
+}
+
+void testSessionOptions(Platform& platform) {
+    // Create a random cloud of particles.
+
+    const int numParticles = 10;
+    System system;
+    vector<Vec3> positions(numParticles);
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    for (int i = 0; i < numParticles; i++) {
+        system.addParticle(1.0);
+        positions[i] = Vec3(genrand_real2(sfmt), genrand_real2(sfmt), genrand_real2(sfmt))*10;
+    }
+    map<string, string> properties = {{"IntraOpThreads", "1"}, {"InterOpThreads", "1"}, {"GraphOptimizationLevel", "basic"},
+            {"ExecutionMode", "parallel"}, {"EnableMemoryPattern", "false"}, {"EnableCpuMemArena", "false"}, {"AllowSpinning", "false"}};
+    OnnxForce* force = new OnnxForce("tests/central.onnx", properties);
+    system.addForce(force);
+
+    // Make sure the forces are computed correctly with non-default options.
+
+    VerletIntegrator integ(1.0);
+    {
+        Context context(system, integ, platform);
+        context.setPositions(positions);
+        State state = context.getState(State::Forces);
+        for (int i = 0; i < numParticles; i++)
+            ASSERT_EQUAL_VEC(positions[i]*(-2.0), state.getForces()[i], 1e-5);
+    }
+
+    // An illegal value should produce an exception.
+
+    for (auto property : vector<pair<string, string> >{{"GraphOptimizationLevel", "maximal"}, {"AllowSpinning", "sometimes"}}) {
+        force->setProperty("GraphOptimizationLevel", "basic");
+        force->setProperty("AllowSpinning", "auto");
+        force->setProperty(property.first, property.second);
+        bool threwException = false;
+        try {
+            VerletIntegrator integ2(1.0);
+            Context context(system, integ2, platform);
+        }
+        catch (const OpenMMException& ex) {
+            threwException = true;
+        }
+        ASSERT(threwException);
+    }
+
+    // Earlier tests created the environment without global thread pools, so they cannot be enabled now.
+
+    force->setProperty("AllowSpinning", "auto");
+    force->setProperty("GlobalThreadPool", "true");
+    bool threwException = false;
+    try {
+        VerletIntegrator integ2(1.0);
+        Context context(system, integ2, platform);
+    }
+    catch (const OpenMMException& ex) {
+        threwException = true;
+    }
+    ASSERT(threwException);
+}
+
+string createTempDirectory() {
+    const char* parent = getenv("TMPDIR");
+    if (parent == nullptr)
+        parent = getenv("TEMP");
+    string path = string(parent == nullptr ? "/tmp" : parent)+"/OnnxForceTest"+to_string(random_device()());
+#ifdef _WIN32
+    int result = _mkdir(path.c_str());
+#else
+    int result = mkdir(path.c_str(), 0700);
+#endif
+    if (result != 0)
+        throw OpenMMException("Failed to create directory "+path);
+    return path;
+}
+
+vector<string> listDirectory(const string& path) {
+    vector<string> files;
+#ifdef _WIN32
+    WIN32_FIND_DATAA data;
+    HANDLE handle = FindFirstFileA((path+"/*").c_str(), &data);
+    if (handle != INVALID_HANDLE_VALUE) {
+        do {
+            string name = data.cFileName;
+            if (name != "." && name != "..")
+                files.push_back(name);
+        } while (FindNextFileA(handle, &data));
+        FindClose(handle);
+    }
+#else
+    DIR* dir = opendir(path.c_str());
+    if (dir != nullptr) {
+        while (dirent* entry = readdir(dir)) {
+            string name = entry->d_name;
+            if (name != "." && name != "..")
+                files.push_back(name);
+        }
+        closedir(dir);
+    }
+#endif
+    return files;
+}
+
+void removeDirectory(const string& path) {
+    for (const string& file : listDirectory(path))
+        remove((path+"/"+file).c_str());
+#ifdef _WIN32
+    _rmdir(path.c_str());
+#else
+    rmdir(path.c_str());
+#endif
+}
+
+void testOptimizedModelCache(Platform& platform) {
+    // Create a random cloud of particles.
+
+    const int numParticles = 10;
+    System system;
+    vector<Vec3> positions(numParticles);
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    for (int i = 0; i < numParticles; i++) {
+        system.addParticle(1.0);
+        positions[i] = Vec3(genrand_real2(sfmt), genrand_real2(sfmt), genrand_real2(sfmt))*10;
+    }
+    string cacheDir = createTempDirectory();
+    OnnxForce* force = new OnnxForce("tests/central.onnx", {{"OptimizedModelCachePath", cacheDir}});
+    force->setExecutionProvider(OnnxForce::CPU);
+    system.addForce(force);
+    try {
+        // The first Context should save the optimized model, and the second one should load it.  Both should
+        // produce correct forces.  The CPU provider is used, since with TensorRT nothing would be saved.
+
+        for (int i = 0; i < 2; i++) {
+            VerletIntegrator integ(1.0);
+            Context context(system, integ, platform);
+            context.setPositions(positions);
+            State state = context.getState(State::Forces);
+            for (int j = 0; j < numParticles; j++)
+                ASSERT_EQUAL_VEC(positions[j]*(-2.0), state.getForces()[j], 1e-5);
+            vector<string> files = listDirectory(cacheDir);
+            ASSERT_EQUAL(1, (int) files.size());
+            ASSERT(files[0].size() > 5 && files[0].substr(files[0].size()-5) == ".onnx");
+        }
+
+        // Replace the saved model with an invalid file.  Creating a Context should now fail, which shows it
+        // really is loading the saved model.
+
+        string file = cacheDir+"/"+listDirectory(cacheDir)[0];
+        ofstream(file, ios::binary) << "not a model";
+        bool threwException = false;
+        try {
+            VerletIntegrator integ(1.0);
+            Context context(system, integ, platform);
+        }
+        catch (const exception& ex) {
+            threwException = true;
+        }
+        ASSERT(threwException);
+    }
+    catch (...) {
+        removeDirectory(cacheDir);
+        throw;
+    }
+    removeDirectory(cacheDir);
+}
+
+void testBatchGroup(Platform& platform) {
+    // Create several random clouds of particles.
+
+    const int numParticles = 10;
+    const int numReplicas = 3;
+    System system;
+    vector<vector<Vec3> > positions(numReplicas, vector<Vec3>(numParticles));
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    for (int i = 0; i < numParticles; i++)
+        system.addParticle(1.0);
+    for (int i = 0; i < numReplicas; i++)
+        for (int j = 0; j < numParticles; j++)
+            positions[i][j] = Vec3(genrand_real2(sfmt), genrand_real2(sfmt), genrand_real2(sfmt))*10;
+    // The timeout is long enough that the batch should only be evaluated once every replica has arrived.
+
+    OnnxForce* force = new OnnxForce("tests/batched.onnx", {{"BatchGroup", "test"}, {"BatchSize", to_string(numReplicas)},
+            {"BatchTimeout", "10000000"}, {"EnableTiming", "true"}});
+    system.addForce(force);
+
+    // Create a Context for each replica and compute their forces in parallel threads.
+
+    vector<VerletIntegrator*> integrators;
+    vector<Context*> contexts;
+    for (int i = 0; i < numReplicas; i++) {
+        integrators.push_back(new VerletIntegrator(1.0));
+        contexts.push_back(new Context(system, *integrators[i], platform));
+        contexts[i]->setPositions(positions[i]);
+    }
+    vector<vector<Vec3> > forces(numReplicas);
+    vector<double> energy(numReplicas);
+    vector<string> errors(numReplicas);
+    vector<thread> threads;
+    for (int i = 0; i < numReplicas; i++)
+        threads.emplace_back([&, i] () {
+            try {
+                State state = contexts[i]->getState(State::Energy | State::Forces);
+                forces[i] = state.getForces();
+                energy[i] = state.getPotentialEnergy();
+            }
+            catch (const exception& ex) {
+                errors[i] = ex.what();
+            }
+        });
+    for (thread& t : threads)
+        t.join();
+
+    // Check the results.  The network defines a potential of the form E(r) = |r|^2
+
+    for (int i = 0; i < numReplicas; i++) {
+        if (errors[i].size() > 0)
+            throw OpenMMException(errors[i]);
+        double expectedEnergy = 0;
+        for (int j = 0; j < numParticles; j++) {
+            expectedEnergy += positions[i][j].dot(positions[i][j]);
+            ASSERT_EQUAL_VEC(positions[i][j]*(-2.0), forces[i][j], 1e-5);
+        }
+        ASSERT_EQUAL_TOL(expectedEnergy, energy[i], 1e-5);
+    }
+
+    // All the replicas should have been evaluated in a single call to the model.
+
+    for (int i = 0; i < numReplicas; i++) {
+        map<string, double> stats = force->getTimingStatistics(*contexts[i]);
+        ASSERT_EQUAL(1, stats["evaluations"]);
+        ASSERT_EQUAL(numReplicas, stats["batchSize"]);
+    }
+
+    // The extra inputs cannot be changed, since they are shared by the whole batch.
+
+    bool threwException = false;
+    try {
+        force->updateInputsInContext(*contexts[0]);
+    }
+    catch (const OpenMMException& ex) {
+        threwException = true;
+    }
+    ASSERT(threwException);
+    for (int i = 0; i < numReplicas; i++) {
+        delete contexts[i];
+        delete integrators[i];
+    }
+
+    // A single Context should still get the correct result once the timeout expires.  Changing the timeout
+    // puts it in a different group from the Contexts above.  It is also warmed up through the group, which
+    // should not affect the result.
+
+    force->setProperty("BatchTimeout", "1000");
+    force->setProperty("Warmup", "true");
+    VerletIntegrator integrator(1.0);
+    Context context(system, integrator, platform);
+    ASSERT_EQUAL(0, force->getTimingStatistics(context)["evaluations"]);
+    context.setPositions(positions[0]);
+    State state = context.getState(State::Forces);
+    for (int j = 0; j < numParticles; j++)
+        ASSERT_EQUAL_VEC(positions[0][j]*(-2.0), state.getForces()[j], 1e-5);
+    ASSERT_EQUAL(1, force->getTimingStatistics(context)["evaluations"]);
+    ASSERT_EQUAL(1, force->getTimingStatistics(context)["batchSize"]);
+}
+
+void testAsyncEvaluation(Platform& platform) {
+    // Create a random cloud of particles.
+
+    const int numParticles = 10;
+    System system;
+    vector<Vec3> positions(numParticles);
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    for (int i = 0; i < numParticles; i++) {
+        system.addParticle(1.0);
+        positions[i] = Vec3(genrand_real2(sfmt), genrand_real2(sfmt), genrand_real2(sfmt));
+    }
+    OnnxForce* force = new OnnxForce("tests/central.onnx");
+    system.addForce(force);
+
+    // Simulate the system with synchronous and asynchronous evaluation.  The trajectories should be identical.
+
+    vector<Vec3> finalPositions[2];
+    for (int i = 0; i < 2; i++) {
+        force->setProperty("AsyncEvaluation", i == 0 ? "false" : "true");
+        VerletIntegrator integ(0.001);
+        Context context(system, integ, platform);
+        context.setPositions(positions);
+        integ.step(10);
+        finalPositions[i] = context.getState(State::Positions).getPositions();
+        State state = context.getState(State::Forces);
+        for (int j = 0; j < numParticles; j++)
+            ASSERT_EQUAL_VEC(finalPositions[i][j]*(-2.0), state.getForces()[j], 1e-5);
+    }
+    for (int i = 0; i < numParticles; i++)
+        ASSERT_EQUAL_VEC(finalPositions[0][i], finalPositions[1][i], 1e-5);
+}
+
+void testTimingStatistics(Platform& platform) {
+    const int numParticles = 5;
+    System system;
+    vector<Vec3> positions;
+    for (int i = 0; i < numParticles; i++) {
+        system.addParticle(1.0);
+        positions.push_back(Vec3(i, 0.5*i, -0.2*i));
+    }
+    OnnxForce* force = new OnnxForce("tests/central.onnx");
+    force->setProperty("EnableTiming", "true");
+    system.addForce(force);
+    VerletIntegrator integ(1.0);
+    Context context(system, integ, platform);
+
+    // Compute forces three times.  The second time the positions have not changed, so the model should
+    // not be evaluated again.
+
+    context.setPositions(positions);
+    context.getState(State::Forces);
+    context.getState(State::Forces);
+    positions[0][0] += 0.1;
+    context.setPositions(positions);
+    context.getState(State::Forces);
+    map<string, double> stats = force->getTimingStatistics(context);
+    ASSERT_EQUAL(3.0, stats["calls"]);
+    ASSERT_EQUAL(2.0, stats["evaluations"]);
+    for (string phase : {"parameters", "gather", "run", "scatter"}) {
+        ASSERT(stats[phase+"Total"] >= stats[phase+"Last"]);
+        ASSERT(stats[phase+"Last"] >= 0);
+    }
+    ASSERT(stats["runTotal"] > 0);
+
+    // Without EnableTiming, nothing should be recorded.
+
+    System system2;
+    for (int i = 0; i < numParticles; i++)
+        system2.addParticle(1.0);
+    OnnxForce* force2 = new OnnxForce("tests/central.onnx");
+    system2.addForce(force2);
+    VerletIntegrator integ2(1.0);
+    Context context2(system2, integ2, platform);
+    context2.setPositions(positions);
+    context2.getState(State::Forces);
+    for (auto& stat : force2->getTimingStatistics(context2))
+        ASSERT_EQUAL(0.0, stat.second);
+}
+
+void testWarmup(Platform& platform) {
+    const int numParticles = 5;
+    System system;
+    vector<Vec3> positions;
+    for (int i = 0; i < numParticles; i++) {
+        system.addParticle(1.0);
+        positions.push_back(Vec3(i, 0.5*i, -0.2*i));
+    }
+    OnnxForce* force = new OnnxForce("tests/central.onnx");
+    force->setEnergyOnlyModel("tests/energyonly.onnx");
+    force->setProperty("Warmup", "true");
+    force->setProperty("EnableTiming", "true");
+    system.addForce(force);
+    VerletIntegrator integ(1.0);
+    Context context(system, integ, platform);
+
+    // The warmup evaluation should not be counted, and its results should not be used.
+
+    ASSERT_EQUAL(0.0, force->getTimingStatistics(context)["evaluations"]);
+    context.setPositions(positions);
+    double expectedEnergy = 0;
+    for (int i = 0; i < numParticles; i++)
+        expectedEnergy += positions[i].dot(positions[i]);
+    State state = context.getState(State::Energy | State::Forces);
+    ASSERT_EQUAL_TOL(expectedEnergy, state.getPotentialEnergy(), 1e-5);
+    for (int i = 0; i < numParticles; i++)
+        ASSERT_EQUAL_VEC(positions[i]*(-2.0), state.getForces()[i], 1e-5);
+    ASSERT_EQUAL(1.0, force->getTimingStatistics(context)["evaluations"]);
 }
 
 void testPlatform(Platform& platform) {
     testForce(platform, {});
     testForce(platform, {0, 1, 2, 9, 5});
+    testForce(platform, {3, 4, 5, 6});
+    testForce(platform, {}, 3);
+    testForce(platform, {0, 1, 2, 9, 5}, 3);
     testPeriodicForce(platform);
     testGlobal(platform);
+    testParameterDerivatives(platform);
+    testEnergyConservation(platform);
+    testEvaluationInterval(platform);
     testInputs(platform);
+    testUpdateParticleIndices(platform);
+    testDoublePrecision(platform);
+    testSharedModel(platform);
+    testNeighborList(platform, false, false);
+    testNeighborList(platform, true, false);
+    testNeighborList(platform, true, true);
+    testDomainDecomposition(platform, false);
+    testDomainDecomposition(platform, true);
+    testEnergyOnlyModel(platform);
+    testAdditionalModels(platform);
+    testMultipleContexts(platform);
+    testSessionOptions(platform);
+    testOptimizedModelCache(platform);
+    testBatchGroup(platform);
+    testAsyncEvaluation(platform);
+    testTimingStatistics(platform);
+    testWarmup(platform);
 }
 
 int main(int argc, char* argv[]) {
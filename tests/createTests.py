@@ -50,6 +50,23 @@ torch.onnx.export(model=Global(),
                   dynamic_axes={"positions":[0], "forces":[0]})
 
 
+class Derivatives(torch.nn.Module):
+    def forward(self, positions, k):
+        positions.grad = None
+        k.grad = None
+        energy = k*torch.sum(positions*positions)
+        energy.backward()
+        forces = -positions.grad
+        return energy, forces, k.grad
+
+torch.onnx.export(model=Derivatives(),
+                  args=(torch.ones(1, 3, requires_grad=True), torch.ones(1, requires_grad=True)),
+                  f="derivatives.onnx",
+                  input_names=["positions", "k"],
+                  output_names=["energy", "forces", "energyParameterDerivatives"],
+                  dynamic_axes={"positions":[0], "forces":[0]})
+
+
 class Inputs(torch.nn.Module):
     def forward(self, positions, scale, offset):
         positions.grad = None
@@ -65,3 +82,100 @@ torch.onnx.export(model=Inputs(),
                   input_names=["positions", "scale", "offset"],
                   output_names=["energy", "forces"],
                   dynamic_axes={"positions":[0], "scale":[0], "offset":[0], "forces":[0]})
+
+
+class Batched(torch.nn.Module):
+    def forward(self, positions):
+        positions.grad = None
+        energy = torch.sum(positions*positions, dim=(1, 2))
+        energy.backward(torch.ones_like(energy))
+        forces = -positions.grad
+        return energy, forces
+
+torch.onnx.export(model=Batched(),
+                  args=(torch.ones(1, 1, 3, requires_grad=True),),
+                  f="batched.onnx",
+                  input_names=["positions"],
+                  output_names=["energy", "forces"],
+                  dynamic_axes={"positions":[0, 1], "energy":[0], "forces":[0, 1]})
+
+
+class Double(torch.nn.Module):
+    def forward(self, positions, k, scale):
+        positions.grad = None
+        r = torch.sum(positions*positions, dim=1)
+        energy = k*torch.sum(scale*r)
+        energy.backward()
+        forces = -positions.grad
+        return energy, forces
+
+torch.onnx.export(model=Double(),
+                  args=(torch.ones(1, 3, dtype=torch.float64, requires_grad=True), torch.ones(1, dtype=torch.float64), torch.ones(1, dtype=torch.int64)),
+                  f="double.onnx",
+                  input_names=["positions", "k", "scale"],
+                  output_names=["energy", "forces"],
+                  dynamic_axes={"positions":[0], "scale":[0], "forces":[0]})
+
+
+class Neighbors(torch.nn.Module):
+    def forward(self, positions, neighbors, neighborShifts):
+        positions.grad = None
+        delta = positions[neighbors[1]] - positions[neighbors[0]] + neighborShifts
+        r2 = torch.sum(delta*delta, dim=1)
+        energy = 0.5*torch.sum(torch.where(r2 < 1.0, r2, torch.zeros_like(r2)))
+        energy.backward()
+        forces = -positions.grad
+        return energy, forces
+
+torch.onnx.export(model=Neighbors(),
+                  args=(torch.ones(2, 3, requires_grad=True), torch.tensor([[0, 1], [1, 0]], dtype=torch.int32), torch.zeros(2, 3)),
+                  f="neighbors.onnx",
+                  input_names=["positions", "neighbors", "neighborShifts"],
+                  output_names=["energy", "forces"],
+                  dynamic_axes={"positions":[0], "neighbors":[1], "neighborShifts":[0], "forces":[0]})
+
+
+class EnergyOnly(torch.nn.Module):
+    def forward(self, positions):
+        # This deliberately returns twice the energy of Central, so tests can tell which model was used.
+        energy = torch.sum(positions*positions)*2
+        return energy
+
+torch.onnx.export(model=EnergyOnly(),
+                  args=(torch.ones(1, 3),),
+                  f="energyonly.onnx",
+                  input_names=["positions"],
+                  output_names=["energy"],
+                  dynamic_axes={"positions":[0]})
+
+
+class Domains(torch.nn.Module):
+    def __init__(self, periodic):
+        super().__init__()
+        self.periodic = periodic
+
+    def forward(self, positions, box, ownedParticles):
+        delta = positions.unsqueeze(1) - positions.unsqueeze(0)
+        if self.periodic:
+            boxsize = torch.diagonal(box)
+            delta = delta - torch.round(delta/boxsize)*boxsize
+        r2 = torch.sum(delta*delta, dim=2)
+        u = (1.0-r2)*(r2 < 1.0).float()
+        owned = ownedParticles.float()
+        energy = 0.5*torch.sum(owned.unsqueeze(1)*u*(1.0-r2))
+        forces = torch.sum(((owned.unsqueeze(1)+owned.unsqueeze(0))*2.0*u).unsqueeze(2)*delta, dim=1)
+        return energy, forces
+
+torch.onnx.export(model=Domains(False),
+                  args=(torch.ones(2, 3), torch.eye(3), torch.ones(2, dtype=torch.int32)),
+                  f="domains.onnx",
+                  input_names=["positions", "box", "ownedParticles"],
+                  output_names=["energy", "forces"],
+                  dynamic_axes={"positions":[0], "ownedParticles":[0], "forces":[0]})
+
+torch.onnx.export(model=Domains(True),
+                  args=(torch.ones(2, 3), torch.eye(3), torch.ones(2, dtype=torch.int32)),
+                  f="domainsperiodic.onnx",
+                  input_names=["positions", "box", "ownedParticles"],
+                  output_names=["energy", "forces"],
+                  dynamic_axes={"positions":[0], "ownedParticles":[0], "forces":[0]})